@@ -23,21 +23,84 @@
 #include <string>
 #include <utility>
 #include <map>
+#include <set>
 #include <list>
+#include <vector>
 #include <memory>
 #include <functional>
 #include <algorithm>
 #include <ctime>
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <argp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <csignal>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <climits>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#ifdef HAVE_STD_FROM_CHARS
+#include <charconv>
+#endif
 #define RAPIDJSON_HAS_STDSTRING 1
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
+#include "ofx_reader.h"
+
+using ofx2json::str_view;
+using ofx2json::fold_upper;
+using ofx2json::name_hash;
+using ofx2json::name_equals;
+using ofx2json::skip_ws;
+using ofx2json::ofx_reader;
 
-static char* g_input = nullptr;
+static std::vector<std::string> g_inputs;
 static char *g_output = nullptr;
+static char *g_output_dir = nullptr;
+static char *g_journal = nullptr;
+static char *g_watch_dir = nullptr;
+static char *g_error_dir = nullptr;
+static char *g_csv = nullptr;
+static char *g_stats = nullptr;
+static char *g_tape = nullptr;
+static char *g_lots = nullptr;
+static char *g_rules = nullptr;
+static char *g_base_currency = nullptr;
+static char *g_rates = nullptr;
+static int g_transfer_days = -1;
+static unsigned g_jobs = 0;
+static unsigned g_io_depth = 64;
 static bool g_quiet = false;
+static bool g_canonical = false;
+static bool g_raw_numbers = false;
+static bool g_utc = false;
+static bool g_utc_offsets = false;
+static bool g_zero_copy = false;
+static bool g_validate = false;
+static bool g_from_tape = false;
+static bool g_running_balance = false;
+static bool g_positions = false;
+static bool g_recurring = false;
 
 #ifdef DEBUG
 #define _logLocationStmt \
@@ -55,23 +118,15 @@ static bool g_quiet = false;
 		__os _logLocationStmt << stmt << std::endl; \
 	}
 
-static inline std::string str_lower(const std::string& str)
+static inline std::string str_lower(str_view str)
 {
-	std::string ret(str);
+	std::string ret(str.data(), str.size());
 	std::transform(ret.begin(), ret.end(), ret.begin(), ::tolower);
 	return ret;
 }
 
-static inline bool skip_ws(const std::string& str, size_t& pos)
-{
-	size_t start = pos;
-	while (pos < str.size() && isspace(str[pos]))
-		pos++;
-	return pos > start;
-}
-
 template <typename IntType>
-static size_t parse_digits(const std::string& text, size_t pos, size_t len, IntType& val)
+static size_t parse_digits(str_view text, size_t pos, size_t len, IntType& val)
 {
 	val = 0;
 	size_t slen = text.size();
@@ -81,6 +136,17 @@ static size_t parse_digits(const std::string& text, size_t pos, size_t len, IntT
 			return 0;
 		slen = pos + len;
 	}
+#ifdef HAVE_STD_FROM_CHARS
+	if (pos >= slen || !isdigit(text[pos]))
+		return 0;
+	auto res = std::from_chars(text.data() + pos, text.data() + slen, val);
+	if (res.ec != std::errc())
+		return 0;
+	size_t i = res.ptr - (text.data() + pos);
+	if (len != std::string::npos && i != len)
+		return 0;
+	return i;
+#else
 	size_t i = 0;
 	while (pos + i < slen)
 	{
@@ -99,14 +165,16 @@ static size_t parse_digits(const std::string& text, size_t pos, size_t len, IntT
 		i++;
 	}
 	return i;
+#endif
 }
 
-static bool parse_datetime(const std::string& text, struct tm& tm, unsigned int& msecs, int& tzoff_min)
+static bool parse_datetime(str_view text, struct tm& tm, unsigned int& msecs, int& tzoff_min)
 {
 	size_t len = text.size();
 	if (len < 8)
 		return false;
 	tzoff_min = 0;
+	msecs = 0;
 	if (!parse_digits(text, 0, 4, tm.tm_year) || tm.tm_year > 9999)
 		return false;
 	tm.tm_year -= 1900;
@@ -154,7 +222,7 @@ static bool parse_datetime(const std::string& text, struct tm& tm, unsigned int&
 						return false;
 				}
 				size_t digs = parse_digits(text, i, std::string::npos, tzoff_min);
-				if (digs == 0 || tzoff_min > 12)
+				if (digs == 0 || tzoff_min > 14)
 					return false;
 				tzoff_min *= 60;
 				i += digs;
@@ -165,12 +233,22 @@ static bool parse_datetime(const std::string& text, struct tm& tm, unsigned int&
 					if (++i >= len)
 						return false;
 					
+					// Both fractions of an hour ("5.5", "5.75") and minutes
+					// ("5.30", "5.45") are found in the wild.  One digit is
+					// always a fraction, two digits are minutes if they are
+					// a multiple of 15 below 60 (".15", ".30", ".45") and
+					// hundredths of an hour otherwise (".25", ".50", ".75").
 					int tzoff_frac = 0;
 					digs = parse_digits(text, i, std::string::npos, tzoff_frac);
-					if (digs == 0 || tzoff_frac)
+					if (digs == 1)
+						tzoff_min += tzoff_frac * 6;
+					else if (digs == 2 && tzoff_frac < 60 && tzoff_frac % 15 == 0)
+						tzoff_min += tzoff_frac;
+					else if (digs == 2)
+						tzoff_min += tzoff_frac * 60 / 100;
+					else
 						return false;
 					i += digs;
-					// TODO: adjust tzoff_min by minutes in tzoff_frac, or is tzoff_frac a fraction of a whole hour?
 				}
 				if (neg)
 					tzoff_min = -tzoff_min;
@@ -215,7 +293,116 @@ static bool parse_datetime(const std::string& text, struct tm& tm, unsigned int&
 	return true;
 }
 
-static bool parse_number(const std::string& text, double& val)
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t& y, unsigned& m, unsigned& d)
+{
+	z += 719468;
+	int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = (unsigned)(z - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	y = (int64_t)yoe + era * 400 + (m <= 2);
+}
+
+// Days since 1970-01-01 of seconds since the epoch in UTC
+static int32_t epoch_day(int64_t secs)
+{
+	int64_t sod = secs % 86400;
+	if (sod < 0)
+		sod += 86400;
+	return (int32_t)((secs - sod) / 86400);
+}
+
+// Parses a date into seconds since the epoch in UTC
+static bool parse_epoch(str_view text, int64_t& secs)
+{
+	struct tm tm;
+	unsigned int msecs;
+	int tzoff_min;
+	if (!parse_datetime(text, tm, msecs, tzoff_min))
+		return false;
+	int64_t days = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+	secs = days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec - tzoff_min * 60;
+	return true;
+}
+
+// Formats an UTC offset as +HH (if whole hours and not always_min) or +HH:MM
+static void format_tzoff(char *buf, int tzoff_min, bool always_min)
+{
+	int off = abs(tzoff_min);
+	if (off % 60 != 0 || always_min)
+		sprintf(buf, "%c%02d:%02d", tzoff_min < 0 ? '-' : '+', off / 60, off % 60);
+	else
+		sprintf(buf, "%c%02d", tzoff_min < 0 ? '-' : '+', off / 60);
+}
+
+// Formats a parsed datetime as ISO 8601 in UTC, using integer arithmetic
+// only.  Milliseconds are written if present or if always_msecs is set.
+static void format_datetime_utc(char *buf, const struct tm& tm, unsigned msecs, int tzoff_min, bool always_msecs)
+{
+	int64_t days = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+	int64_t secs = days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec - tzoff_min * 60;
+	int64_t sod = secs % 86400;
+	if (sod < 0)
+		sod += 86400;
+	days = (secs - sod) / 86400;
+	int64_t y;
+	unsigned m, d;
+	civil_from_days(days, y, m, d);
+	int len = sprintf(buf, "%04d-%02u-%02uT%02d:%02d:%02d", (int)y, m, d, (int)(sod / 3600), (int)(sod / 60 % 60), (int)(sod % 60));
+	if (msecs != 0 || always_msecs)
+		len += sprintf(&buf[len], ".%03u", msecs);
+	buf[len++] = 'Z';
+	buf[len] = '\0';
+}
+
+// Formats seconds since the epoch as a UTC date
+static std::string format_time(int64_t secs)
+{
+	int64_t sod = secs % 86400;
+	if (sod < 0)
+		sod += 86400;
+	int64_t y;
+	unsigned m, d;
+	civil_from_days((secs - sod) / 86400, y, m, d);
+	char buf[64];
+	snprintf(buf, sizeof buf, "%04d-%02u-%02uT%02d:%02d:%02dZ", (int)y, m, d, (int)(sod / 3600), (int)(sod / 60 % 60), (int)(sod % 60));
+	return buf;
+}
+
+// Formats a parsed date for output, in UTC with --utc or --canonical.
+// buf must hold at least 64 characters.
+static void format_datetime(char *buf, const struct tm& tm, unsigned msecs, int tzoff_min)
+{
+	if (g_canonical || g_utc)
+	{
+		format_datetime_utc(buf, tm, msecs, tzoff_min, g_canonical);
+		return;
+	}
+	size_t len = strftime(buf, 64, "%FT%T", &tm);
+	if (tzoff_min == 0)
+	{
+		buf[len++] = 'Z';
+		buf[len] = '\0';
+	}
+	else
+		format_tzoff(&buf[len], tzoff_min, false);
+}
+
+static bool parse_number(str_view text, double& val)
 {
 	double r = 0.0;
 	double f = 1.0;
@@ -264,1355 +451,5770 @@ static bool parse_number(const std::string& text, double& val)
 	return true;
 }
 
-static bool parse_bool(const std::string& text, bool& val)
+// Correctly rounded conversion of a decimal number, optionally with a
+// fraction (including "5." and ".5") and an exponent.  Values with up to 19
+// significant digits whose mantissa fits into a double and with a small
+// exponent are converted exactly with one multiplication or division
+// (Clinger's fast path); everything else goes through from_chars or strtod.
+static bool parse_float(str_view text, double& val)
 {
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
 	size_t pos = 0;
 	skip_ws(text, pos);
-	if (pos >= text.length())
-		return false;
-	char ch = text[pos];
-	if (ch == 'Y' || ch == 'y')
-		val = true;
-	else if (ch == 'N' || ch == 'n')
-		val = false;
-	else
-		return false;
-	skip_ws(text, ++pos);
-	return pos >= text.length();
-}
-
-static bool read_text(const std::string& str, size_t& pos, std::string& txt)
-{
-	skip_ws(str, pos);
-	while (pos < str.size())
+	bool neg = false;
+	if (pos < text.length() && (text[pos] == '-' || text[pos] == '+'))
+	{
+		neg = (text[pos] == '-');
+		pos++;
+	}
+	size_t start = pos;
+	uint64_t mant = 0;
+	int exp10 = 0;
+	size_t digits = 0, sig = 0;
+	bool isf = false, truncated = false;
+	while (pos < text.length())
 	{
-		char ch = str[pos];
-		if (ch == '<' || ch == '>')
+		char ch = text[pos];
+		if (ch == '.')
+		{
+			if (isf)
+				return false;
+			isf = true;
+		}
+		else if (ch >= '0' && ch <= '9')
 		{
-			if (!txt.empty())
+			digits++;
+			if (mant == 0 && ch == '0')
 			{
-				size_t i = txt.size();
-				while (i > 0 && isspace(txt[i - 1]))
-					i--;
-				txt.erase(i);
+				if (isf)
+					exp10--;
+			}
+			else if (sig < 19)
+			{
+				mant = mant * 10 + (ch - '0');
+				sig++;
+				if (isf)
+					exp10--;
+			}
+			else
+			{
+				truncated = true;
+				if (!isf)
+					exp10++;
 			}
-			return true;
 		}
-		txt.push_back(ch);
+		else
+			break;
 		pos++;
 	}
-	
-	return false;
-}
-
-static bool read_name(const std::string& str, size_t& pos, std::string& txt)
-{
-	while (pos < str.size())
+	if (digits == 0)
+		return false;
+	if (pos < text.length() && (text[pos] == 'e' || text[pos] == 'E'))
 	{
-		char ch = str[pos];
-		if (isspace(ch) || ch == '<' || ch == '>' || ch == '/' || ch == '=' || ch == '\"')
-			return !txt.empty();
-		txt.push_back(ch);
 		pos++;
+		bool eneg = false;
+		if (pos < text.length() && (text[pos] == '-' || text[pos] == '+'))
+		{
+			eneg = (text[pos] == '-');
+			pos++;
+		}
+		int e = 0;
+		size_t edigits = 0;
+		while (pos < text.length() && text[pos] >= '0' && text[pos] <= '9')
+		{
+			if (e < 100000)
+				e = e * 10 + (text[pos] - '0');
+			edigits++;
+			pos++;
+		}
+		if (edigits == 0)
+			return false;
+		exp10 += eneg ? -e : e;
 	}
-	
-	if (!txt.empty())
-		return true;
-	if (pos >= str.size())
+	size_t end = pos;
+	skip_ws(text, pos);
+	if (pos < text.length())
 		return false;
-	return false;
-}
-
-static bool read_attrval(const std::string& str, size_t& pos, std::string& txt, bool quoted)
-{
-	while (pos < str.size())
+	
+	if (!truncated && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
 	{
-		char ch = str[pos];
-		if (!quoted && (isspace(ch) || ch == '<' || ch == '>' || ch == '/' || ch == '=' || ch == '\"'))
-			return !txt.empty();
-		else if (quoted && ch == '\"')
-			return !txt.empty();
-		
-		txt.push_back(ch);
-		pos++;
+		val = (double)mant;
+		if (exp10 < 0)
+			val /= pow10[-exp10];
+		else
+			val *= pow10[exp10];
 	}
-	
-	if (!quoted && !txt.empty())
-		return true;
-	if (pos >= str.size())
-		return false;
-	return false;
-}
-
-static std::string try_xml_decode(const std::string& txt)
-{
-	std::string ret;
-	ret.reserve(txt.size());
-	size_t pos = 0;
-	while (pos < txt.size())
+	else
 	{
-		char ch = txt[pos];
-		if (ch == '&')
-		{
-			std::string entity;
-			bool found_end = false;
-			for (size_t i = 0; i < 5 && pos + 1 + i < txt.size(); i++)
-			{
-				char ch_e = txt[pos + 1 + i];
-				if (ch_e == ';')
-				{
-					found_end = true;
-					break;
-				}
-				entity.push_back(ch_e);
-			}
-			
-			if (found_end && !entity.empty())
-			{
-				static const std::map<std::string, char> xml_entities = {
-					{ "quot", '\"' },
-					{ "amp", '&' },
-					{ "apos", '\'' },
-					{ "lt", '<' },
-					{ "gt", '>' },
-				};
-				
-				auto const& it = xml_entities.find(entity);
-				if (it != xml_entities.end())
-				{
-					ret.append(1, it->second);
-					pos += entity.size() + 2;
-					continue;
-				}
-			}
-		}
-		
-		ret.push_back(ch);
-		pos++;
+#ifdef HAVE_STD_FROM_CHARS_DOUBLE
+		auto res = std::from_chars(text.data() + start, text.data() + end, val);
+		if (res.ec != std::errc() || res.ptr != text.data() + end)
+			return false;
+#else
+		errno = 0;
+		val = strtod(std::string(text.substr(start, end - start)).c_str(), nullptr);
+		if (errno == ERANGE)
+			return false;
+#endif
 	}
-	
-	return ret;
+	if (neg)
+		val = -val;
+	if (val == 0.0)
+		val = 0.0; // no negative zero
+	return true;
 }
 
-template <typename HandleElement>
-static bool iterate_elements(const std::string& str, size_t& pos, HandleElement handle_element)
+// Checks whether text is a valid JSON number, so it can be written as is
+static bool is_json_number(str_view text)
 {
-	while (pos < str.size())
-	{
-		skip_ws(str, pos);
-		if (pos >= str.size())
-			break;
-		if (str[pos] != '<')
-			return false;
+	size_t pos = 0, len = text.size();
+	if (pos < len && text[pos] == '-')
 		pos++;
-		skip_ws(str, pos);
-		if (pos >= str.size())
-			return false;
-		std::string el_name;
-		bool simple_tag = false;
-		if (str[pos] == '/')
-		{
-			el_name.push_back('/');
+	if (pos >= len || !isdigit(text[pos]))
+		return false;
+	if (text[pos++] != '0')
+	{
+		while (pos < len && isdigit(text[pos]))
 			pos++;
-			skip_ws(str, pos);
-			if (pos >= str.size())
-				return false;
-		}
-		std::string el_text;
-		std::map<std::string, std::string> el_attrs;
-		if (!read_name(str, pos, el_name))
+	}
+	if (pos < len && text[pos] == '.')
+	{
+		if (++pos >= len || !isdigit(text[pos]))
 			return false;
-		assert(!el_name.empty());
-		if (el_name[0] != '/')
-		{
-			if (skip_ws(str, pos))
-			{
-				do
-				{
-					if (str[pos] == '>' || str[pos] == '/')
-						break;
-					
-					std::string at_name, at_val;
-					if (!read_name(str, pos, at_name))
-						return false;
-					skip_ws(str, pos);
-					if (pos >= str.size())
-						return false;
-					if (str[pos] == '=')
-					{
-						pos++;
-						skip_ws(str, pos);
-						if (pos >= str.size())
-							return false;
-						bool quoted = (str[pos] == '\"');
-						if (quoted)
-							pos++;
-						if (!read_attrval(str, pos, at_val, quoted))
-							return false;
-						if (quoted)
-						{
-							if (str[pos] != '\"')
-								return false;
-							pos++;
-						}
-					}
-					skip_ws(str, pos);
-					el_attrs.insert(std::make_pair(at_name, try_xml_decode(at_val)));
-				} while (pos < str.size());
-			}
-			
-			if (pos >= str.size())
-				return false;
-			
-			
-			if (str.size() > 1 && str[pos] == '/')
-			{
-				simple_tag = true;
-				pos++;
-			}
-			
-			skip_ws(str, pos);
-			if (pos >= str.size() || str[pos] != '>')
-				return false;
+		while (pos < len && isdigit(text[pos]))
 			pos++;
-			
-			if (!simple_tag && !read_text(str, pos, el_text))
-				return false;
-		}
-		else
-		{
-			skip_ws(str, pos);
-			if (pos >= str.size() || str[pos] != '>')
-				return false;
+	}
+	if (pos < len && (text[pos] == 'e' || text[pos] == 'E'))
+	{
+		pos++;
+		if (pos < len && (text[pos] == '-' || text[pos] == '+'))
 			pos++;
-		}
-		
-		if (el_name == "/OFX")
-			break;
-		
-		if (!handle_element(el_name, el_attrs, try_xml_decode(el_text)))
+		if (pos >= len || !isdigit(text[pos]))
 			return false;
-		if (simple_tag)
-		{
-			assert(el_name[0] != '/');
-			if (!handle_element('/' + el_name, el_attrs, std::string()))
-				return false;
-		}
+		while (pos < len && isdigit(text[pos]))
+			pos++;
 	}
-	
-	return true;
+	return pos == len;
 }
 
-struct ofx_container;
-
-struct process_ctx
+// Fixed point decimal with 9 fractional digits, for amounts and units that
+// have to add up exactly.  Input with more fractional digits and the results
+// of multiplications and divisions are rounded half to even.  Products that
+// overflow throw std::overflow_error.
+struct decimal
 {
-	std::shared_ptr<rapidjson::Document> doc_;
-	std::list<std::unique_ptr<ofx_container>> ostack_;
+	typedef __int128 int_type;
 	
-	template <typename Doc>
-	process_ctx(Doc doc):
-		doc_(doc)
+	int_type v_;
+	
+	decimal():
+		v_(0)
 	{
 	}
 	
-	void push_container(ofx_container *container)
+	static int_type scale()
 	{
-		ostack_.push_front(std::unique_ptr<ofx_container>(container));
+		return 1000000000;
 	}
 	
-	void pop_container()
+	// Largest magnitude parse accepts, leaving room for sums
+	static int_type max_value()
 	{
-		ostack_.pop_front();
+		return ((int_type)1) << 100;
 	}
-};
-
-struct ofx_cont
-{
-	enum serialize_as
-	{
-		nothing = 0,
-		object,
-		object_in_array,
-		object_with_name_in_array,
-		array
-	};
 	
-	enum tag_fmt
+	static decimal raw(int_type v)
 	{
-		string = 0,
-		number,
-		boolean,
-		datetime
-	};
+		decimal d;
+		d.v_ = v;
+		return d;
+	}
 	
-	serialize_as serialize;
-	std::map<std::string, const ofx_cont*> sub;
-	std::map<std::string const, tag_fmt> tags;
-};
-
-struct ofx_container
-{
-	const std::string name_;
-	const ofx_cont * const cont_;
-	process_ctx& pctx_;
-	std::shared_ptr<rapidjson::Value> val_;
-	std::list<std::pair<std::string, std::string>> tags_;
+	static int_type mul_checked(int_type a, int_type b)
+	{
+		int_type p;
+		if (__builtin_mul_overflow(a, b, &p))
+			throw std::overflow_error("decimal overflow");
+		return p;
+	}
 	
-	ofx_container(const std::string& name, const ofx_cont *cont, process_ctx& pctx):
-		name_(name),
-		cont_(cont),
-		pctx_(pctx)
+	static int_type div_round(int_type n, int_type d)
 	{
-		switch (cont_->serialize)
+		int_type q = n / d;
+		int_type r = n % d;
+		if (r != 0)
 		{
-			case ofx_cont::object:
-			case ofx_cont::object_in_array:
-			case ofx_cont::object_with_name_in_array:
-				val_ = std::make_shared<rapidjson::Value>(rapidjson::kObjectType);
-				break;
-			case ofx_cont::array:
-				val_ = std::make_shared<rapidjson::Value>(rapidjson::kArrayType);
-				break;
-			default:
-				val_ = !pctx_.ostack_.empty() ? pctx_.ostack_.front()->val_ : pctx_.doc_;
-				break;
+			int_type r2 = r < 0 ? -r : r;
+			int_type d2 = d < 0 ? -d : d;
+			bool neg = (n < 0) != (d < 0);
+			if (r2 * 2 > d2 || (r2 * 2 == d2 && (q & 1)))
+				q += neg ? -1 : 1;
 		}
+		return q;
 	}
 	
-	void done()
+	static bool parse(str_view text, decimal& d)
 	{
-		assert(!pctx_.ostack_.empty());
-		auto it = pctx_.ostack_.begin();
-		assert(it->get() == this);
-		if (++it != pctx_.ostack_.end())
+		size_t pos = 0;
+		skip_ws(text, pos);
+		bool neg = false;
+		if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+			neg = (text[pos++] == '-');
+		int_type v = 0;
+		int frac = -1;
+		bool digits = false, sticky = false;
+		int first = -1; // first digit beyond the precision
+		const int_type limit = max_value() / 10;
+		for (; pos < text.size(); pos++)
 		{
-			auto pcontainer = it->get();
-			switch (cont_->serialize)
+			char ch = text[pos];
+			if (ch == '.' && frac < 0)
+				frac = 0;
+			else if (ch >= '0' && ch <= '9')
 			{
-				case ofx_cont::object:
-				case ofx_cont::array:
-					pcontainer->val_->AddMember(rapidjson::Value(str_lower(name_).c_str(), pctx_.doc_->GetAllocator()), *val_, pctx_.doc_->GetAllocator());
-					break;
-				case ofx_cont::object_in_array:
-					pcontainer->val_->PushBack(*val_, pctx_.doc_->GetAllocator());
-					break;
-				case ofx_cont::object_with_name_in_array:
+				digits = true;
+				if (frac >= 9)
 				{
-					rapidjson::Value obj(rapidjson::kObjectType);
-					obj.AddMember(rapidjson::Value(str_lower(name_).c_str(), pctx_.doc_->GetAllocator()), *val_, pctx_.doc_->GetAllocator());
-					pcontainer->val_->PushBack(obj, pctx_.doc_->GetAllocator());
-					break;
+					if (first < 0)
+						first = ch - '0';
+					else if (ch != '0')
+						sticky = true;
+					continue;
 				}
-				default:
-					break;
+				if (v > limit)
+					return false;
+				v = v * 10 + (ch - '0');
+				if (frac >= 0)
+					frac++;
 			}
+			else
+				break;
 		}
-	};
+		skip_ws(text, pos);
+		if (!digits || pos < text.size())
+			return false;
+		for (int i = frac < 0 ? 0 : frac; i < 9; i++)
+		{
+			if (v > limit)
+				return false;
+			v *= 10;
+		}
+		if (first > 5 || (first == 5 && (sticky || (v & 1))))
+			v++;
+		if (v > max_value())
+			return false;
+		d.v_ = neg ? -v : v;
+		return true;
+	}
 	
-	void add_datetime(const std::string& element, const std::string& text)
+	std::string str() const
 	{
-		struct tm tm;
-		unsigned int msecs;
-		int tzoff_min;
-		if (parse_datetime(text, tm, msecs, tzoff_min))
+		int_type a = v_ < 0 ? -v_ : v_;
+		int_type ip = a / scale();
+		int64_t fp = (int64_t)(a % scale());
+		char buf[64];
+		size_t len = sizeof buf;
+		buf[--len] = '\0';
+		do
 		{
-			char buf[26];
-			size_t len = strftime(buf, sizeof buf, "%FT%T", &tm);
-			if (tzoff_min == 0)
-			{
-				buf[len++] = 'Z';
-				buf[len] = '\0';
-			}
-			else
-			{
-				int off_min = abs(tzoff_min) % 60;
-				if (off_min != 0)
-					sprintf(&buf[len], "%+03d:%02d", tzoff_min / 60, off_min);
-				else
-					sprintf(&buf[len], "%+03d", tzoff_min / 60);
-			}
-			add_string(element, buf);
+			buf[--len] = '0' + (int)(ip % 10);
+			ip /= 10;
+		} while (ip);
+		std::string ret = v_ < 0 ? "-" : "";
+		ret += &buf[len];
+		if (fp)
+		{
+			char frac[16];
+			snprintf(frac, sizeof frac, ".%09lld", (long long)fp);
+			size_t flen = strlen(frac);
+			while (frac[flen - 1] == '0')
+				flen--;
+			ret.append(frac, flen);
 		}
-		else
-			add_string(element, text);
+		return ret;
 	}
 	
-	void add_number(const std::string& element, const std::string& text)
+	bool is_zero() const { return v_ == 0; }
+	bool negative() const { return v_ < 0; }
+	decimal abs() const { return raw(v_ < 0 ? -v_ : v_); }
+	decimal operator-() const { return raw(-v_); }
+	decimal operator+(decimal o) const { return raw(v_ + o.v_); }
+	decimal operator-(decimal o) const { return raw(v_ - o.v_); }
+	decimal& operator+=(decimal o) { v_ += o.v_; return *this; }
+	decimal& operator-=(decimal o) { v_ -= o.v_; return *this; }
+	decimal operator*(decimal o) const { return raw(div_round(mul_checked(v_, o.v_), scale())); }
+	bool operator==(decimal o) const { return v_ == o.v_; }
+	bool operator!=(decimal o) const { return v_ != o.v_; }
+	bool operator<(decimal o) const { return v_ < o.v_; }
+	bool operator>(decimal o) const { return v_ > o.v_; }
+	bool operator<=(decimal o) const { return v_ <= o.v_; }
+	bool operator>=(decimal o) const { return v_ >= o.v_; }
+	
+	// a * b / c, rounded once
+	static decimal mul_div(decimal a, decimal b, decimal c)
 	{
-		double val;
-		if (parse_number(text, val))
-			val_->AddMember(rapidjson::Value(str_lower(element).c_str(), pctx_.doc_->GetAllocator()), rapidjson::Value(val), pctx_.doc_->GetAllocator());
-		else
+		return raw(div_round(mul_checked(a.v_, b.v_), c.v_));
+	}
+};
+
+static bool parse_bool(str_view text, bool& val)
+{
+	size_t pos = 0;
+	skip_ws(text, pos);
+	if (pos >= text.length())
+		return false;
+	char ch = text[pos];
+	if (ch == 'Y' || ch == 'y')
+		val = true;
+	else if (ch == 'N' || ch == 'n')
+		val = false;
+	else
+		return false;
+	skip_ws(text, ++pos);
+	return pos >= text.length();
+}
+
+template <typename HandleElement>
+static bool iterate_elements(std::string& str, size_t& pos, bool insitu, HandleElement handle_element)
+{
+	ofx_reader reader(str, pos, insitu);
+	for (;;)
+	{
+		const ofx_reader::token& tok = reader.next();
+		pos = reader.pos();
+		switch (tok.kind_)
 		{
-			std::cerr << '<' << element << "> failed to parse '" << text << "' as a number" << std::endl;
-			abort();
-			add_string(element, text);
+			case ofx_reader::eof:
+				return true;
+			case ofx_reader::start_tag:
+				if (!handle_element(tok.name_, tok.hash_, false, *tok.attrs_, reader.take_text()))
+					return false;
+				break;
+			case ofx_reader::empty_tag:
+				if (!handle_element(tok.name_, tok.hash_, false, *tok.attrs_, str_view()))
+					return false;
+				if (!handle_element(tok.name_, tok.hash_, true, *tok.attrs_, str_view()))
+					return false;
+				break;
+			case ofx_reader::end_tag:
+				if (name_equals(tok.name_, "OFX"))
+					return true;
+				if (!handle_element(tok.name_, tok.hash_, true, *tok.attrs_, str_view()))
+					return false;
+				break;
+			default:
+				return false;
 		}
 	}
+}
+
+// A converted document.  With --raw-numbers, numbers are kept as their
+// input text in strings referenced by raw_numbers_, which
+// raw_number_writer writes as raw JSON numbers.
+struct ofx_document : rapidjson::Document
+{
+	std::unordered_set<const char*> raw_numbers_;
 	
-	void add_bool(const std::string& element, const std::string& text)
+	ofx_document():
+		rapidjson::Document(rapidjson::kObjectType)
 	{
-		bool val;
-		if (parse_bool(text, val))
-			val_->AddMember(rapidjson::Value(str_lower(element).c_str(), pctx_.doc_->GetAllocator()), rapidjson::Value(val), pctx_.doc_->GetAllocator());
-		else
-		{
-			std::cerr << '<' << element << "> failed to parse '" << text << "' as a boolean" << std::endl;
-			abort();
-			add_string(element, text);
-		}
 	}
+};
+
+// Per document set of distinct strings.  Each string is copied into the
+// document's allocator once and referenced by all values using it.  The
+// index of a string in strs_ is its id for dictionary encoding.
+struct string_pool
+{
+	struct entry
+	{
+		const char *str_;
+		uint32_t len_;
+		uint32_t hash_;
+	};
+	
+	rapidjson::Document::AllocatorType& alloc_;
+	std::vector<entry> strs_;
+	std::vector<uint32_t> slots_; // index into strs_ + 1, 0 if free
 	
-	void add_string(const std::string& element, const std::string& text)
+	string_pool(rapidjson::Document::AllocatorType& alloc):
+		alloc_(alloc),
+		slots_(64, 0)
 	{
-		val_->AddMember(rapidjson::Value(str_lower(element).c_str(), pctx_.doc_->GetAllocator()), rapidjson::Value(text.c_str(), pctx_.doc_->GetAllocator()), pctx_.doc_->GetAllocator());
 	}
 	
-	bool handle_tag(const std::string& element, const std::map<std::string, std::string>& /*attrs*/, const std::string& text)
+	static uint32_t hash(const char *str, size_t len)
 	{
-		auto its = cont_->sub.find(element);
-		if (its != cont_->sub.end())
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < len; i++)
 		{
-			pctx_.push_container(new ofx_container(its->first, its->second, pctx_));
-		}
-		else
-		{
-			auto itt = cont_->tags.find(element);
-			if (itt != cont_->tags.end())
-			{
-				switch (itt->second)
-				{
-					case ofx_cont::string:
-						add_string(element, text);
-						break;
-					case ofx_cont::number:
-						add_number(element, text);
-						break;
-					case ofx_cont::boolean:
-						add_bool(element, text);
-						break;
-					case ofx_cont::datetime:
-						add_datetime(element, text);
-						break;
-				}
-			}
-			else
-				logErr('<' << name_ << "> unhandled element: '" << element << "' text: '" << text << "'");
-			tags_.push_back(std::make_pair(element, text));
+			h ^= (unsigned char)str[i];
+			h *= 16777619u;
 		}
-		return true;
+		return h;
 	}
 	
-	bool handle_close(const std::string& close_tag, bool& container_done)
+	void grow()
 	{
-		bool found = false;
-		while (!tags_.empty() && !found)
+		std::vector<uint32_t> slots(slots_.size() * 2, 0);
+		size_t mask = slots.size() - 1;
+		for (uint32_t i = 0; i < strs_.size(); i++)
 		{
-			auto const& t = tags_.back();
-			if (t.first == close_tag)
-				found = true;
-			tags_.pop_back();
+			size_t s = strs_[i].hash_ & mask;
+			while (slots[s])
+				s = (s + 1) & mask;
+			slots[s] = i + 1;
 		}
-		if (tags_.empty() && close_tag == name_)
+		slots_.swap(slots);
+	}
+	
+	uint32_t intern(str_view str)
+	{
+		uint32_t h = hash(str.data(), str.size());
+		size_t mask = slots_.size() - 1;
+		size_t s = h & mask;
+		while (uint32_t idx = slots_[s])
 		{
-			container_done = true;
-			return true;
+			const entry& e = strs_[idx - 1];
+			if (e.hash_ == h && e.len_ == str.size() && memcmp(e.str_, str.data(), e.len_) == 0)
+				return idx - 1;
+			s = (s + 1) & mask;
 		}
 		
-		return found;
+		char *copy = static_cast<char*>(alloc_.Malloc(str.size() + 1));
+		memcpy(copy, str.data(), str.size());
+		copy[str.size()] = '\0';
+		uint32_t id = strs_.size();
+		strs_.push_back(entry{copy, (uint32_t)str.size(), h});
+		slots_[s] = id + 1;
+		if (strs_.size() * 2 > slots_.size())
+			grow();
+		return id;
 	}
-};
-
-static const ofx_cont ofx_status = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "CODE", ofx_cont::string },
-		{ "SEVERITY", ofx_cont::string },
-		{ "MESSAGE", ofx_cont::string },
+	
+	rapidjson::Value value(str_view str)
+	{
+		const entry& e = strs_[intern(str)];
+		return rapidjson::Value(rapidjson::StringRef(e.str_, e.len_));
+	}
+	
+	// Member names are the lower case element names
+	rapidjson::Value name(str_view element)
+	{
+		char buf[64];
+		if (element.size() > sizeof buf)
+			return value(str_lower(element));
+		for (size_t i = 0; i < element.size(); i++)
+			buf[i] = tolower(element[i]);
+		return value(str_view(buf, element.size()));
 	}
 };
 
-static const ofx_cont ofx_signon_sonrs_fi = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "ORG", ofx_cont::string },
-		{ "FID", ofx_cont::string },
-	}
+struct ofx_cont
+{
+	enum serialize_as
+	{
+		nothing = 0,
+		object,
+		object_in_array,
+		object_with_name_in_array,
+		array
+	};
+	
+	enum tag_fmt
+	{
+		string = 0,
+		number,
+		boolean,
+		datetime,
+		amount,
+		symbol // string with few distinct values, stored once per document
+	};
+	
+	serialize_as serialize;
+	std::map<std::string, const ofx_cont*> sub;
+	std::map<std::string const, tag_fmt> tags;
+	bool sub_arrays; // collect sub containers into one array per name
 };
 
-static const ofx_cont ofx_signon_sonrs = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "STATUS", &ofx_status },
-		{ "FI", &ofx_signon_sonrs_fi },
-	},
-	tags: {
-		{ "DTSERVER", ofx_cont::datetime },
-		{ "DTPROFUP", ofx_cont::datetime },
-		{ "LANGUAGE", ofx_cont::string },
-		{ "SESSCOOKIE", ofx_cont::string },
+// Open addressing index over the sub and tags of a table by case folded
+// name hash.  Sub containers point to the index of their table.  The
+// indexes are built along with the tables of each schema, see schema_root.
+// Names missing from a version specific table are looked up in the full
+// table of the same aggregate, so that a version only narrows the tables
+// it searches first, never what is converted.
+struct cont_index
+{
+	struct entry
+	{
+		uint32_t hash_;
+		const std::string* name_; // nullptr if free
+		const cont_index* sub_;
+		ofx_cont::tag_fmt fmt_;
+	};
+	
+	const ofx_cont* cont_;
+	std::vector<entry> slots_;
+	const cont_index* full_; // nullptr for the full tables
+	
+	const entry* lookup(str_view name, uint32_t hash) const
+	{
+		size_t mask = slots_.size() - 1;
+		for (size_t s = hash & mask; slots_[s].name_; s = (s + 1) & mask)
+		{
+			if (slots_[s].hash_ == hash && name_equals(*slots_[s].name_, name))
+				return &slots_[s];
+		}
+		return full_ ? full_->lookup(name, hash) : nullptr;
 	}
 };
 
-static const ofx_cont ofx_signonmsgsrsv1 = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "SONRS", &ofx_signon_sonrs },
-	},
-	tags: {}
+// Tables for a range of header VERSIONs.  Aggregates that differ from the
+// full tables are listed as variants, see schema_root.
+struct ofx_schema
+{
+	const char* name;
+	unsigned min_version;
+	unsigned max_version;
+	std::vector<std::pair<const ofx_cont*, const ofx_cont*>> variants;
 };
 
-static const ofx_cont ofx_signupmsgsrsv1 = {
-	serialize: ofx_cont::object,
-	sub: {}, // TODO
-	tags: {} // TODO
-};
+static inline bool member_name_less(const rapidjson::Value& a, const rapidjson::Value& b)
+{
+	size_t alen = a.GetStringLength(), blen = b.GetStringLength();
+	int cmp = memcmp(a.GetString(), b.GetString(), std::min(alen, blen));
+	return cmp < 0 || (cmp == 0 && alen < blen);
+}
 
-static const ofx_cont ofx_investment_entry_status = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "CODE", ofx_cont::string },
-		{ "SEVERITY", ofx_cont::string },
+// Stable sort of the members of an object by name.  Member lists are short
+// and mostly sorted already, so a simple insertion sort is sufficient.
+static void sort_members(rapidjson::Value& obj)
+{
+	auto begin = obj.MemberBegin();
+	auto end = obj.MemberEnd();
+	if (begin == end)
+		return;
+	for (auto it = begin + 1; it != end; ++it)
+	{
+		for (auto jt = it; jt != begin && member_name_less(jt->name, (jt - 1)->name); --jt)
+		{
+			jt->name.Swap((jt - 1)->name);
+			jt->value.Swap((jt - 1)->value);
+		}
 	}
-};
+}
 
-static const ofx_cont ofx_invacctfrom = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "BROKERID", ofx_cont::string },
-		{ "ACCTID", ofx_cont::string },
+// Categorization rules, one per line as tab separated fields
+//   CATEGORY PATTERN [CONDITION]...
+// where a condition is trntype=TYPE, min=AMOUNT or max=AMOUNT on TRNAMT.
+// A rule applies to a STMTTRN whose NAME, MEMO or PAYEE NAME contains
+// PATTERN, ignoring case, and meets all conditions; the first one wins.
+// The patterns are compiled into an Aho-Corasick automaton, so the text of
+// a transaction is matched against all of them in a single pass.
+struct category_rules
+{
+	struct rule
+	{
+		std::string category_;
+		std::string trntype_;
+		decimal min_;
+		decimal max_;
+		bool has_min_;
+		bool has_max_;
+	};
+	
+	struct state
+	{
+		uint32_t edges_; // first edge in edges_, sorted by class
+		uint32_t nedges_;
+		uint32_t fail_;
+		uint32_t dict_; // next state on the fail chain with rules, 0 if none
+		int32_t out_; // index into outputs_, -1 if no pattern ends here
+	};
+	
+	typedef std::pair<uint16_t, uint32_t> edge;
+	
+	// States are numbered breadth first, so the shallow states where most
+	// steps end up come first.  Up to this many table entries, their
+	// transitions are resolved in a dense table and need no fail links.
+	static const size_t dense_entries = 1 << 20;
+	
+	std::vector<rule> rules_;
+	std::vector<state> states_;
+	std::vector<edge> edges_;
+	std::vector<std::vector<uint32_t>> outputs_; // rule ids by pattern
+	uint16_t classes_[256]; // characters of patterns, 0 for all others
+	unsigned nclasses_;
+	std::vector<uint32_t> dense_;
+	uint32_t ndense_;
+	
+	category_rules(const char *path)
+	{
+		std::ifstream fi(path);
+		if (!fi)
+			throw std::runtime_error("cannot open rules");
+		std::vector<std::string> patterns;
+		std::string line;
+		for (unsigned lineno = 1; std::getline(fi, line); lineno++)
+		{
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty() || line[0] == '#')
+				continue;
+			std::vector<std::string> fields;
+			size_t start = 0, tab;
+			while ((tab = line.find('\t', start)) != std::string::npos)
+			{
+				fields.push_back(line.substr(start, tab - start));
+				start = tab + 1;
+			}
+			fields.push_back(line.substr(start));
+			if (fields.size() < 2 || fields[0].empty() || fields[1].empty())
+				throw std::runtime_error("line " + std::to_string(lineno) + ": expected CATEGORY and PATTERN");
+			
+			rule r{fields[0], std::string(), decimal(), decimal(), false, false};
+			for (size_t i = 2; i < fields.size(); i++)
+			{
+				const std::string& cond = fields[i];
+				bool ok = true;
+				if (cond.compare(0, 8, "trntype=") == 0)
+					r.trntype_ = cond.substr(8);
+				else if (cond.compare(0, 4, "min=") == 0)
+					ok = r.has_min_ = decimal::parse(str_view(cond.data() + 4, cond.size() - 4), r.min_);
+				else if (cond.compare(0, 4, "max=") == 0)
+					ok = r.has_max_ = decimal::parse(str_view(cond.data() + 4, cond.size() - 4), r.max_);
+				else
+					ok = false;
+				if (!ok)
+					throw std::runtime_error("line " + std::to_string(lineno) + ": invalid condition '" + cond + "'");
+			}
+			rules_.push_back(std::move(r));
+			patterns.push_back(std::move(fields[1]));
+		}
+		build(patterns);
 	}
-};
-
-static const ofx_cont ofx_currency = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "CURRATE", ofx_cont::string },
-		{ "CURSYM", ofx_cont::string },
+	
+	void build(const std::vector<std::string>& patterns)
+	{
+		memset(classes_, 0, sizeof classes_);
+		nclasses_ = 1;
+		for (auto const& p : patterns)
+		{
+			for (char c : p)
+			{
+				unsigned char u = (unsigned char)fold_upper(c);
+				if (!classes_[u])
+					classes_[u] = nclasses_++;
+			}
+		}
+		
+		std::vector<std::map<uint16_t, uint32_t>> trie(1);
+		std::vector<int32_t> out(1, -1);
+		for (uint32_t id = 0; id < patterns.size(); id++)
+		{
+			uint32_t s = 0;
+			for (char c : patterns[id])
+			{
+				uint16_t cls = classes_[(unsigned char)fold_upper(c)];
+				auto it = trie[s].find(cls);
+				if (it != trie[s].end())
+					s = it->second;
+				else
+				{
+					uint32_t t = trie.size();
+					trie[s][cls] = t;
+					trie.emplace_back();
+					out.push_back(-1);
+					s = t;
+				}
+			}
+			if (out[s] < 0)
+			{
+				out[s] = outputs_.size();
+				outputs_.emplace_back();
+			}
+			outputs_[out[s]].push_back(id);
+		}
+		
+		// Renumber breadth first and flatten the trie
+		std::vector<uint32_t> order(1, 0), ids(trie.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			ids[order[i]] = i;
+			for (auto const& e : trie[order[i]])
+				order.push_back(e.second);
+		}
+		states_.resize(trie.size());
+		for (uint32_t s = 0; s < order.size(); s++)
+		{
+			auto const& children = trie[order[s]];
+			states_[s] = state{(uint32_t)edges_.size(), (uint32_t)children.size(), 0, 0, out[order[s]]};
+			for (auto const& e : children)
+				edges_.push_back(edge(e.first, ids[e.second]));
+		}
+		
+		// Fail links point to shallower states, which come first
+		ndense_ = std::min(states_.size(), dense_entries / nclasses_);
+		dense_.assign((size_t)ndense_ * nclasses_, 0);
+		for (uint32_t s = 0; s < states_.size(); s++)
+		{
+			const state& st = states_[s];
+			for (uint32_t i = st.edges_; i < st.edges_ + st.nedges_; i++)
+			{
+				uint32_t t = edges_[i].second;
+				if (s != 0)
+				{
+					uint32_t f = step(st.fail_, edges_[i].first);
+					states_[t].fail_ = f;
+					states_[t].dict_ = states_[f].out_ >= 0 ? f : states_[f].dict_;
+				}
+			}
+			if (s < ndense_)
+			{
+				uint32_t *row = &dense_[(size_t)s * nclasses_];
+				if (s != 0)
+					memcpy(row, &dense_[(size_t)st.fail_ * nclasses_], nclasses_ * sizeof *row);
+				for (uint32_t i = st.edges_; i < st.edges_ + st.nedges_; i++)
+					row[edges_[i].first] = edges_[i].second;
+				row[0] = 0;
+			}
+		}
 	}
-};
-
-static const ofx_cont ofx_escrwamt = {
-	serialize: ofx_cont::object,
-	sub: {
-	},
-	tags: {
-		{ "ESCRWTOTAL", ofx_cont::number },
-		{ "ESCRWTAX", ofx_cont::number },
-		{ "ESCRWINS", ofx_cont::number },
-		{ "ESCRWPMI", ofx_cont::number },
-		{ "ESCRWFEES", ofx_cont::number },
-		{ "ESCRWOTHER", ofx_cont::number },
+	
+	uint32_t step(uint32_t s, uint16_t cls) const
+	{
+		while (s >= ndense_)
+		{
+			const state& st = states_[s];
+			auto begin = edges_.begin() + st.edges_;
+			auto end = begin + st.nedges_;
+			auto it = std::lower_bound(begin, end, cls,
+				[](const edge& e, uint16_t cls) { return e.first < cls; });
+			if (it != end && it->first == cls)
+				return it->second;
+			s = st.fail_;
+		}
+		return dense_[(size_t)s * nclasses_ + cls];
 	}
-};
-
-static const ofx_cont ofx_payee = {
-	serialize: ofx_cont::object,
-	sub: {
-	},
-	tags: {
-		{ "NAME", ofx_cont::string },
-		{ "ADDR1", ofx_cont::string },
-		{ "ADDR2", ofx_cont::string },
-		{ "ADDR3", ofx_cont::string },
-		{ "CITY", ofx_cont::string },
-		{ "STATE", ofx_cont::string },
-		{ "POSTALCODE", ofx_cont::string },
-		{ "COUNTRY", ofx_cont::string },
-		{ "PHONE", ofx_cont::string },
+	
+	// Appends the ids of the rules whose pattern occurs in text
+	void match(str_view text, std::vector<uint32_t>& hits) const
+	{
+		uint32_t s = 0;
+		for (char c : text)
+		{
+			s = step(s, classes_[(unsigned char)fold_upper(c)]);
+			for (uint32_t o = states_[s].out_ >= 0 ? s : states_[s].dict_; o != 0; o = states_[o].dict_)
+				hits.insert(hits.end(), outputs_[states_[o].out_].begin(), outputs_[states_[o].out_].end());
+		}
+	}
+	
+	// First rule of hits whose conditions hold, nullptr if none
+	const rule* select(const std::vector<uint32_t>& hits, str_view trntype, const decimal* amount) const
+	{
+		const rule* best = nullptr;
+		for (uint32_t id : hits)
+		{
+			const rule& r = rules_[id];
+			if (best && &r >= best)
+				continue;
+			if (!r.trntype_.empty() && !name_equals(trntype, r.trntype_))
+				continue;
+			if ((r.has_min_ || r.has_max_) && !amount)
+				continue;
+			if ((r.has_min_ && *amount < r.min_) || (r.has_max_ && *amount > r.max_))
+				continue;
+			best = &r;
+		}
+		return best;
 	}
 };
 
-static const ofx_cont ofx_bankacctto = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "BANKID", ofx_cont::string },
-		{ "BRANCHID", ofx_cont::string },
-		{ "ACCTID", ofx_cont::string },
-		{ "ACCTTYPE", ofx_cont::string },
-		{ "ACCTKEY", ofx_cont::string },
-	}
-};
-
-
-static const ofx_cont ofx_ccacct_fromorto = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "ACCTID", ofx_cont::string },
-		{ "ACCTKEY", ofx_cont::string },
-	}
-};
+static std::unique_ptr<const category_rules> g_category_rules;
 
-static const ofx_cont ofx_loanpmtinfo = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "ESCRWAMT", &ofx_escrwamt },
-	},
-	tags: {
-		{ "PRINAMT", ofx_cont::number },
-		{ "INTAMT", ofx_cont::number },
-		{ "INSURANCE", ofx_cont::number },
-		{ "LATEFEEAMT", ofx_cont::number },
-		{ "OTHERAMT", ofx_cont::number },
+// Daily exchange rates into the base currency, one per line as
+//   DATE,CURRENCY,RATE
+// with DATE as YYYYMMDD and RATE the base amount of one CURRENCY.  The file
+// is mapped and parsed once into an array sorted by currency and day; the
+// rate for a date is the latest one on or before it.
+struct rate_table
+{
+	struct entry
+	{
+		uint32_t cur_;
+		int32_t day_;
+		decimal rate_;
+		
+		bool operator<(const entry& o) const
+		{
+			return cur_ < o.cur_ || (cur_ == o.cur_ && day_ < o.day_);
+		}
+	};
+	
+	std::vector<entry> rates_;
+	
+	// Currency codes of up to four characters packed into an integer
+	static bool code(str_view cur, uint32_t& c)
+	{
+		if (cur.empty() || cur.size() > 4)
+			return false;
+		c = 0;
+		for (char ch : cur)
+			c = (c << 8) | (unsigned char)fold_upper(ch);
+		return true;
 	}
-};
-
-static const ofx_cont ofx_imagedata = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "IMAGETYPE", ofx_cont::string },
-		{ "IMAGEREF", ofx_cont::string },
-		{ "IMAGEREFTYPE", ofx_cont::string },
-		{ "IMAGEDELAY", ofx_cont::string },
-		{ "DTIMAGEAVAIL", ofx_cont::string },
-		{ "IMAGETTL", ofx_cont::string },
-		{ "CHECKSUP", ofx_cont::string },
+	
+	static str_view trim(str_view s)
+	{
+		while (!s.empty() && isspace((unsigned char)s[0]))
+			s = s.substr(1);
+		while (!s.empty() && isspace((unsigned char)s[s.size() - 1]))
+			s = s.substr(0, s.size() - 1);
+		return s;
 	}
-};
-
-static const ofx_cont ofx_stmttrn = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "LOANPMTINFO", &ofx_loanpmtinfo },
-		{ "PAYEE", &ofx_payee },
-		{ "BANKACCTTO", &ofx_bankacctto },
-		{ "CCACCTTO", &ofx_ccacct_fromorto },
-		{ "IMAGEDATA", &ofx_imagedata },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "TRNTYPE", ofx_cont::string },
-		{ "DTPOSTED", ofx_cont::datetime },
-		{ "DTUSER", ofx_cont::datetime },
-		{ "DTAVAIL", ofx_cont::datetime },
-		{ "TRNAMT", ofx_cont::number },
-		{ "FITID", ofx_cont::string },
-		{ "CORRECTFITID", ofx_cont::string },
-		{ "CORRECTACTION", ofx_cont::string },
-		{ "SRVRTID", ofx_cont::string },
-		{ "CHECKNUM", ofx_cont::string },
-		{ "REFNUM", ofx_cont::string },
-		{ "SIC", ofx_cont::string },
-		{ "PAYEEID", ofx_cont::string },
-		{ "NAME", ofx_cont::string },
-		{ "EXTDNAME", ofx_cont::string },
-		{ "MEMO", ofx_cont::string },
-		{ "INV401KSOURCE", ofx_cont::string },
+	
+	rate_table(const char *path)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("cannot open rates");
+		struct stat st;
+		void *map = MAP_FAILED;
+		size_t size = 0;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			size = st.st_size;
+			map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (map == MAP_FAILED)
+			throw std::runtime_error("cannot map rates");
+		
+		str_view text(static_cast<const char*>(map), size);
+		size_t pos = 0;
+		for (unsigned lineno = 1; pos < text.size(); lineno++)
+		{
+			size_t eol = text.find('\n', pos);
+			if (eol == str_view::npos)
+				eol = text.size();
+			str_view line = trim(text.substr(pos, eol - pos));
+			pos = eol + 1;
+			if (line.empty() || line[0] == '#')
+				continue;
+			
+			str_view fields[3];
+			unsigned n = 0;
+			size_t start = 0;
+			for (; n < 3; n++)
+			{
+				size_t comma = n < 2 ? line.find(',', start) : line.size();
+				if (comma == str_view::npos)
+					break;
+				fields[n] = trim(line.substr(start, comma - start));
+				start = comma + 1;
+			}
+			entry e;
+			int64_t secs;
+			if (n == 3 && parse_epoch(fields[0], secs) && code(fields[1], e.cur_) && decimal::parse(fields[2], e.rate_))
+			{
+				e.day_ = epoch_day(secs);
+				rates_.push_back(e);
+			}
+			else if (lineno != 1) // may be a header
+			{
+				munmap(map, size);
+				throw std::runtime_error("line " + std::to_string(lineno) + ": expected DATE,CURRENCY,RATE");
+			}
+		}
+		munmap(map, size);
+		std::stable_sort(rates_.begin(), rates_.end());
 	}
-};
-
-static const ofx_cont ofx_secid = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "UNIQUEID", ofx_cont::string },
-		{ "UNIQUEIDTYPE", ofx_cont::string },
+	
+	bool lookup(str_view cur, int64_t secs, decimal& rate) const
+	{
+		entry key;
+		if (!code(cur, key.cur_))
+			return false;
+		key.day_ = epoch_day(secs);
+		auto it = std::upper_bound(rates_.begin(), rates_.end(), key);
+		if (it == rates_.begin() || (it - 1)->cur_ != key.cur_)
+			return false;
+		rate = (it - 1)->rate_;
+		return true;
 	}
 };
 
-static const ofx_cont ofx_invtran = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "FITID", ofx_cont::string },
-		{ "SRVRTID", ofx_cont::string },
-		{ "DTTRADE", ofx_cont::datetime },
-		{ "DTSETTLE", ofx_cont::datetime },
-		{ "REVERSALFITID", ofx_cont::string },
-		{ "MEMO", ofx_cont::string },
-	}
-};
+static std::unique_ptr<const rate_table> g_rate_table;
 
-static const ofx_cont ofx_invbuy = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-	},
-	tags: {
-		{ "UNITS", ofx_cont::number },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "TOTAL", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "SUBACCTFUND", ofx_cont::string },
-	}
-};
+static const std::set<std::string>& transaction_names();
 
-static const ofx_cont ofx_invsell = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "UNITS", ofx_cont::number },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "MARKDOWN", ofx_cont::number },
-		{ "COMMISSION", ofx_cont::number },
-		{ "TAXES", ofx_cont::number },
-		{ "FEES", ofx_cont::number },
-		{ "LOAD", ofx_cont::number },
-		{ "WITHHOLDING", ofx_cont::number },
-		{ "TAXEXEMPT", ofx_cont::boolean },
-		{ "TOTAL", ofx_cont::number },
-		{ "GAIN", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "SUBACCTFUND", ofx_cont::string },
-		{ "LOANID", ofx_cont::string },
-		{ "STATEWITHHOLDING", ofx_cont::number },
-		{ "PENALTY", ofx_cont::number },
-		{ "INV401KSOURCE", ofx_cont::string },
+// Adds RUNNINGBAL, the balance after each transaction, to the STMTTRN
+// objects of a statement, for --running-balance.  Like the other
+// annotators, it sees the events of dom_sink and adds members to a value
+// when its container closes, before it is attached to the parent.
+struct balance_annotator
+{
+	// What a container contributes to the running balance of a statement
+	enum part { none, statement, tranlist, transaction, ledger };
+	
+	// Amount and posting date of each transaction of the current statement
+	struct txn
+	{
+		decimal amount_;
+		int64_t posted_ = 0;
+	};
+	
+	std::vector<part> parts_; // of the open containers
+	std::vector<txn> txns_;
+	decimal ledger_;
+	int64_t asof_ = 0;
+	bool has_ledger_ = false;
+	bool error_ = false;
+	
+	void open(const std::string& name)
+	{
+		part parent = parts_.empty() ? none : parts_.back();
+		part p = none;
+		if (name_equals(name, "STMTRS") || name_equals(name, "CCSTMTRS"))
+		{
+			p = statement;
+			txns_.clear();
+			has_ledger_ = false;
+			error_ = false;
+		}
+		else if (parent == statement && name_equals(name, "LEDGERBAL"))
+			p = ledger;
+		else if (parent == statement && name_equals(name, "BANKTRANLIST"))
+			p = tranlist;
+		else if (parent == tranlist && name_equals(name, "STMTTRN"))
+		{
+			p = transaction;
+			txns_.emplace_back();
+		}
+		parts_.push_back(p);
 	}
-};
-
-static const ofx_cont ofx_invstmttrnrs_invstmtrs_invtranlist_invbanktran = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "STMTTRN", &ofx_stmttrn },
-	},
-	tags: {
-		{ "SUBACCTFUND", ofx_cont::string },
+	
+	void tag(str_view element, str_view text)
+	{
+		part p = parts_.back();
+		bool ok = true;
+		if (p == transaction && name_equals(element, "TRNAMT"))
+			ok = decimal::parse(text, txns_.back().amount_);
+		else if (p == transaction && name_equals(element, "DTPOSTED"))
+			ok = parse_epoch(text, txns_.back().posted_);
+		else if (p == ledger && name_equals(element, "BALAMT"))
+			has_ledger_ = decimal::parse(text, ledger_);
+		else if (p == ledger && name_equals(element, "DTASOF"))
+			ok = parse_epoch(text, asof_);
+		if (!ok)
+			error_ = true;
 	}
-};
-
-static const ofx_cont ofx_selldebt = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVSELL", &ofx_invsell },
-	},
-	tags: {
-		{ "SELLREASON", ofx_cont::string },
-		{ "ACCRDINT", ofx_cont::number },
+	
+	template <typename Dom>
+	void close(Dom& dom, const std::string& /*name*/, rapidjson::Value& val)
+	{
+		part p = parts_.back();
+		parts_.pop_back();
+		if (p == statement)
+			add_balances(dom, val);
 	}
-};
-
-static const ofx_cont ofx_sellmf = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVSELL", &ofx_invsell },
-	},
-	tags: {
-		{ "SELLTYPE", ofx_cont::string },
-		{ "AVGCOSTBASIS", ofx_cont::number },
-		{ "RELFITID", ofx_cont::string },
+	
+	// The ledger balance is as of DTASOF, so transactions are walked in
+	// posting order back from the last one posted by then and forward from
+	// the first one posted after.
+	template <typename Dom>
+	void add_balances(Dom& dom, rapidjson::Value& stmt)
+	{
+		if (!stmt.IsObject())
+			return;
+		auto list = stmt.FindMember("banktranlist");
+		if (list == stmt.MemberEnd() || !list->value.IsObject())
+			return;
+		auto txns = list->value.FindMember("stmttrn");
+		if (txns == list->value.MemberEnd() || !txns->value.IsArray())
+			return;
+		if (!has_ledger_ || error_ || txns->value.Size() != txns_.size())
+		{
+			logErr("Cannot compute running balance without LEDGERBAL and valid transaction amounts and dates");
+			return;
+		}
+		
+		// Statements are nearly always in posting order already
+		std::vector<size_t> order(txns_.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		for (size_t i = 1; i < txns_.size(); i++)
+		{
+			if (txns_[i].posted_ < txns_[i - 1].posted_)
+			{
+				std::stable_sort(order.begin(), order.end(),
+					[&](size_t a, size_t b) { return txns_[a].posted_ < txns_[b].posted_; });
+				break;
+			}
+		}
+		
+		size_t anchor = 0;
+		while (anchor < order.size() && txns_[order[anchor]].posted_ <= asof_)
+			anchor++;
+		std::vector<decimal> balances(txns_.size());
+		decimal bal = ledger_;
+		for (size_t i = anchor; i-- > 0; )
+		{
+			balances[order[i]] = bal;
+			bal -= txns_[order[i]].amount_;
+		}
+		bal = ledger_;
+		for (size_t i = anchor; i < order.size(); i++)
+		{
+			bal += txns_[order[i]].amount_;
+			balances[order[i]] = bal;
+		}
+		
+		for (size_t i = 0; i < txns_.size(); i++)
+		{
+			auto& txn = txns->value[(rapidjson::SizeType)i];
+			dom.add_decimal(txn, "RUNNINGBAL", balances[i]);
+			if (g_canonical)
+				sort_members(txn);
+		}
 	}
 };
 
-static const ofx_cont ofx_sellopt = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVSELL", &ofx_invsell },
-	},
-	tags: {
-		{ "OPTSELLTYPE", ofx_cont::string },
-		{ "SHPERCTRCT", ofx_cont::number },
-		{ "RELFITID", ofx_cont::string },
-		{ "RELTYPE", ofx_cont::string },
-		{ "SECURED", ofx_cont::string },
+// Adds CATEGORY to each STMTTRN from the first rule of --rules matching its
+// NAME or MEMO, also within PAYEE
+struct category_annotator
+{
+	const category_rules& rules_;
+	unsigned depth_ = 0; // of the open containers
+	unsigned txn_depth_ = 0; // of the current STMTTRN, 0 if none
+	std::vector<uint32_t> hits_;
+	std::string trntype_;
+	decimal amount_;
+	bool has_amount_ = false;
+	
+	category_annotator(const category_rules& rules):
+		rules_(rules)
+	{
 	}
-};
-
-static const ofx_cont ofx_sellother = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVSELL", &ofx_invsell },
-	},
-	tags: {}
-};
-
-static const ofx_cont ofx_sellstock = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVSELL", &ofx_invsell },
-	},
-	tags: {
-		{ "SELLTYPE", ofx_cont::string },
+	
+	void open(const std::string& name)
+	{
+		depth_++;
+		if (!txn_depth_ && name_equals(name, "STMTTRN"))
+		{
+			txn_depth_ = depth_;
+			hits_.clear();
+			trntype_.clear();
+			has_amount_ = false;
+		}
 	}
-};
-
-static const ofx_cont ofx_buydebt = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVBUY", &ofx_invbuy },
-	},
-	tags: {
-		{ "ACCRDINT", ofx_cont::string },
+	
+	void tag(str_view element, str_view text)
+	{
+		if (!txn_depth_)
+			return;
+		if (name_equals(element, "NAME") || name_equals(element, "MEMO"))
+			rules_.match(text, hits_);
+		else if (name_equals(element, "TRNTYPE"))
+			trntype_.assign(text.data(), text.size());
+		else if (name_equals(element, "TRNAMT"))
+			has_amount_ = decimal::parse(text, amount_);
 	}
-};
-
-static const ofx_cont ofx_buymf = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVBUY", &ofx_invbuy },
-	},
-	tags: {
-		{ "BUYTYPE", ofx_cont::string },
-		{ "RELFITID", ofx_cont::string },
+	
+	template <typename Dom>
+	void close(Dom& dom, const std::string& /*name*/, rapidjson::Value& val)
+	{
+		if (depth_-- != txn_depth_)
+			return;
+		txn_depth_ = 0;
+		if (hits_.empty())
+			return;
+		auto r = rules_.select(hits_, trntype_, has_amount_ ? &amount_ : nullptr);
+		if (r)
+			dom.add_symbol(val, "CATEGORY", r->category_);
 	}
 };
 
-static const ofx_cont ofx_buyopt = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVBUY", &ofx_invbuy },
-	},
-	tags: {
-		{ "OPTBUYTYPE", ofx_cont::string },
-		{ "SHPERCTRCT", ofx_cont::number },
+// Adds BASEAMT, the amount of each transaction in the --base-currency, using
+// CURRATE where given and the --rates table for the date otherwise
+struct base_amount_annotator
+{
+	const char* base_;
+	const rate_table* rates_;
+	unsigned depth_ = 0; // of the open containers
+	unsigned txn_depth_ = 0; // of the current transaction, 0 if none
+	unsigned currency_depth_ = 0; // of its CURRENCY, 0 if none
+	std::string curdef_;
+	decimal amount_;
+	bool has_amount_ = false;
+	std::string cursym_;
+	decimal rate_;
+	bool has_rate_ = false;
+	int64_t posted_ = 0;
+	int64_t trade_ = 0;
+	unsigned missing_ = 0;
+	
+	base_amount_annotator(const char* base, const rate_table* rates):
+		base_(base),
+		rates_(rates)
+	{
 	}
-};
-
-static const ofx_cont ofx_buyother = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVBUY", &ofx_invbuy },
-	},
-	tags: {}
-};
-
-static const ofx_cont ofx_buystock = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVBUY", &ofx_invbuy },
-	},
-	tags: {
-		{ "BUYTYPE", ofx_cont::string },
+	
+	void open(const std::string& name)
+	{
+		depth_++;
+		if (txn_depth_)
+		{
+			if (!currency_depth_ && name_equals(name, "CURRENCY"))
+				currency_depth_ = depth_;
+		}
+		else if (transaction_names().count(str_lower(name)))
+		{
+			txn_depth_ = depth_;
+			has_amount_ = has_rate_ = false;
+			cursym_.clear();
+			posted_ = trade_ = 0;
+		}
 	}
-};
-
-static const ofx_cont ofx_closureopt = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-	},
-	tags: {
-		{ "OPTACTION", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
-		{ "SHPERCTRCT", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "RELFITID", ofx_cont::string },
-		{ "GAIN", ofx_cont::number },
+	
+	// With CURRENCY the amounts are in CURSYM and CURRATE converts them to
+	// CURDEF.  With ORIGCURRENCY they are already in CURDEF.
+	void tag(str_view element, str_view text)
+	{
+		if (!txn_depth_)
+		{
+			if (name_equals(element, "CURDEF"))
+				curdef_.assign(text.data(), text.size());
+		}
+		else if (name_equals(element, "TRNAMT") || name_equals(element, "TOTAL"))
+			has_amount_ = decimal::parse(text, amount_);
+		else if (name_equals(element, "DTPOSTED"))
+			parse_epoch(text, posted_);
+		else if (name_equals(element, "DTTRADE"))
+			parse_epoch(text, trade_);
+		else if (currency_depth_ && name_equals(element, "CURSYM"))
+			cursym_.assign(text.data(), text.size());
+		else if (currency_depth_ && name_equals(element, "CURRATE"))
+			has_rate_ = decimal::parse(text, rate_);
 	}
-};
-
-static const ofx_cont ofx_income = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "INCOMETYPE", ofx_cont::string },
-		{ "TOTAL", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "SUBACCTFUND", ofx_cont::string },
-		{ "TAXEXEMPT", ofx_cont::boolean },
-		{ "WITHHOLDING", ofx_cont::number },
-		{ "INV401KSOURCE", ofx_cont::string },
+	
+	template <typename Dom>
+	void close(Dom& dom, const std::string& /*name*/, rapidjson::Value& val)
+	{
+		unsigned depth = depth_--;
+		if (depth == currency_depth_)
+			currency_depth_ = 0;
+		else if (depth == txn_depth_)
+		{
+			txn_depth_ = 0;
+			decimal amount;
+			if (convert(amount))
+				dom.add_decimal(val, "BASEAMT", amount);
+		}
+		if (!depth_ && missing_)
+			logErr(missing_ << " transactions without a rate into " << base_);
 	}
-};
-
-static const ofx_cont ofx_invexpense = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "TOTAL", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "SUBACCTFUND", ofx_cont::string },
-		{ "INV401KSOURCE", ofx_cont::string },
+	
+	bool convert(decimal& amount)
+	{
+		if (!has_amount_)
+			return false;
+		amount = amount_;
+		str_view cur = cursym_.empty() ? str_view(curdef_) : str_view(cursym_);
+		try
+		{
+			if (!cursym_.empty() && has_rate_)
+			{
+				amount = amount * rate_;
+				cur = curdef_;
+			}
+			if (!name_equals(cur, base_))
+			{
+				decimal rate;
+				int64_t date = trade_ ? trade_ : posted_;
+				if (cur.empty() || !date || !rates_ || !rates_->lookup(cur, date, rate))
+				{
+					missing_++;
+					return false;
+				}
+				amount = amount * rate;
+			}
+		}
+		catch (const std::overflow_error& e)
+		{
+			logErr("BASEAMT: " << e.what());
+			return false;
+		}
+		return true;
 	}
 };
 
-static const ofx_cont ofx_jrnlfund = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-	},
-	tags: {
-		{ "SUBACCTTO", ofx_cont::string },
-		{ "SUBACCTFROM", ofx_cont::string },
-		{ "TOTAL", ofx_cont::number },
+// Builds the JSON document.  The member layout follows the serialize
+// settings of the schema tables.
+struct dom_sink
+{
+	struct frame
+	{
+		std::shared_ptr<rapidjson::Value> val_;
+		std::vector<std::pair<std::string, std::vector<rapidjson::Value>>> groups_;
+		
+		// Stages a sub container for the array of its name
+		void collect(const std::string& name, rapidjson::Value& val)
+		{
+			if (groups_.empty() || groups_.back().first != name)
+			{
+				auto it = std::find_if(groups_.begin(), groups_.end(),
+					[&](const std::pair<std::string, std::vector<rapidjson::Value>>& g) { return g.first == name; });
+				if (it != groups_.end())
+				{
+					// the groups stay in order of first appearance
+					it->second.push_back(std::move(val));
+					return;
+				}
+				groups_.emplace_back(name, std::vector<rapidjson::Value>());
+			}
+			groups_.back().second.push_back(std::move(val));
+		}
+	};
+	
+	std::shared_ptr<ofx_document> doc_;
+	string_pool pool_;
+	std::unique_ptr<balance_annotator> balance_;
+	std::unique_ptr<category_annotator> category_;
+	std::unique_ptr<base_amount_annotator> base_amount_;
+	
+	dom_sink(const std::shared_ptr<ofx_document>& doc):
+		doc_(doc),
+		pool_(doc->GetAllocator())
+	{
+		if (g_running_balance)
+			balance_.reset(new balance_annotator());
+		if (g_category_rules)
+			category_.reset(new category_annotator(*g_category_rules));
+		if (g_base_currency)
+			base_amount_.reset(new base_amount_annotator(g_base_currency, g_rate_table.get()));
 	}
-};
-
-static const ofx_cont ofx_jrnlsec = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-	},
-	tags: {
-		{ "SUBACCTTO", ofx_cont::string },
-		{ "SUBACCTFROM", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
+	
+	void open(frame& f, frame* parent, const std::string& name, const ofx_cont* cont)
+	{
+		if (balance_)
+			balance_->open(name);
+		if (category_)
+			category_->open(name);
+		if (base_amount_)
+			base_amount_->open(name);
+		switch (cont->serialize)
+		{
+			case ofx_cont::object:
+			case ofx_cont::object_in_array:
+			case ofx_cont::object_with_name_in_array:
+				f.val_ = std::make_shared<rapidjson::Value>(rapidjson::kObjectType);
+				break;
+			case ofx_cont::array:
+				f.val_ = std::make_shared<rapidjson::Value>(rapidjson::kArrayType);
+				break;
+			default:
+				if (parent)
+					f.val_ = parent->val_;
+				else
+					f.val_ = doc_;
+				break;
+		}
+	}
+	
+	// Adds the staged sub containers as arrays, each allocated just once
+	void flush_groups(frame& f)
+	{
+		auto& alloc = doc_->GetAllocator();
+		for (auto& g : f.groups_)
+		{
+			rapidjson::Value arr(rapidjson::kArrayType);
+			arr.Reserve(g.second.size(), alloc);
+			for (auto& v : g.second)
+				arr.PushBack(v, alloc);
+			f.val_->AddMember(pool_.name(g.first), arr, alloc);
+		}
+		f.groups_.clear();
+	}
+	
+	void close(frame& f, frame* parent, const ofx_cont* parent_cont, const std::string& name, const ofx_cont* cont)
+	{
+		if (!f.groups_.empty())
+			flush_groups(f);
+		if (balance_)
+			balance_->close(*this, name, *f.val_);
+		if (category_)
+			category_->close(*this, name, *f.val_);
+		if (base_amount_)
+			base_amount_->close(*this, name, *f.val_);
+		if (g_canonical && f.val_->IsObject())
+			sort_members(*f.val_);
+		if (parent)
+		{
+			switch (cont->serialize)
+			{
+				case ofx_cont::object:
+				case ofx_cont::array:
+					if (parent_cont->sub_arrays)
+						parent->collect(name, *f.val_);
+					else
+						parent->val_->AddMember(pool_.name(name), *f.val_, doc_->GetAllocator());
+					break;
+				case ofx_cont::object_in_array:
+					parent->val_->PushBack(*f.val_, doc_->GetAllocator());
+					break;
+				case ofx_cont::object_with_name_in_array:
+				{
+					rapidjson::Value obj(rapidjson::kObjectType);
+					obj.AddMember(pool_.name(name), *f.val_, doc_->GetAllocator());
+					parent->val_->PushBack(obj, doc_->GetAllocator());
+					break;
+				}
+				default:
+					break;
+			}
+		}
+	}
+	
+	void tag(frame& f, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		if (balance_)
+			balance_->tag(element, text);
+		if (category_)
+			category_->tag(element, text);
+		if (base_amount_)
+			base_amount_->tag(element, text);
+		switch (fmt)
+		{
+			case ofx_cont::string:
+				add_text(f, element, text);
+				break;
+			case ofx_cont::symbol:
+				add_symbol(*f.val_, element, text);
+				break;
+			case ofx_cont::number:
+				add_number(f, element, text, true);
+				break;
+			case ofx_cont::amount:
+				add_number(f, element, text, g_canonical);
+				break;
+			case ofx_cont::boolean:
+				add_bool(f, element, text);
+				break;
+			case ofx_cont::datetime:
+				add_datetime(f, element, text);
+				break;
+		}
+	}
+	
+	void add_datetime(frame& f, str_view element, str_view text)
+	{
+		struct tm tm;
+		unsigned int msecs;
+		int tzoff_min;
+		if (parse_datetime(text, tm, msecs, tzoff_min))
+		{
+			char buf[64];
+			format_datetime(buf, tm, msecs, tzoff_min);
+			add_string(f, element, buf);
+			if (g_utc_offsets)
+			{
+				char name[64];
+				if (element.size() + 6 <= sizeof name)
+				{
+					memcpy(name, element.data(), element.size());
+					memcpy(&name[element.size()], "TZOFF", 5);
+					format_tzoff(buf, tzoff_min, true);
+					add_string(f, str_view(name, element.size() + 5), buf);
+				}
+			}
+		}
+		else
+			add_text(f, element, text);
+	}
+	
+	// Numbers passed through as text are stored as strings in the
+	// allocator, referenced rather than copied into the value so that
+	// their address, which marks them raw, survives moves of the value.
+	void add_raw_number(rapidjson::Value& obj, str_view element, str_view text)
+	{
+		char *raw = static_cast<char*>(doc_->GetAllocator().Malloc(text.size() + 1));
+		memcpy(raw, text.data(), text.size());
+		raw[text.size()] = '\0';
+		doc_->raw_numbers_.insert(raw);
+		obj.AddMember(pool_.name(element), rapidjson::Value(rapidjson::StringRef(raw, text.size())), doc_->GetAllocator());
+	}
+	
+	// Adds an exact decimal, as a raw number with --raw-numbers
+	void add_decimal(rapidjson::Value& obj, str_view element, decimal d)
+	{
+		std::string str = d.str();
+		double val;
+		if (g_raw_numbers)
+			add_raw_number(obj, element, str);
+		else if (parse_float(str, val))
+			obj.AddMember(pool_.name(element), rapidjson::Value(val), doc_->GetAllocator());
+	}
+	
+	void add_number(frame& f, str_view element, str_view text, bool exact)
+	{
+		if (g_raw_numbers && is_json_number(text))
+		{
+			add_raw_number(*f.val_, element, text);
+			return;
+		}
+		
+		double val;
+		if (exact ? parse_float(text, val) : parse_number(text, val))
+			f.val_->AddMember(pool_.name(element), rapidjson::Value(val), doc_->GetAllocator());
+		else
+			throw std::runtime_error('<' + std::string(element) + "> failed to parse '" + std::string(text) + "' as a number");
+	}
+	
+	void add_bool(frame& f, str_view element, str_view text)
+	{
+		bool val;
+		if (parse_bool(text, val))
+			f.val_->AddMember(pool_.name(element), rapidjson::Value(val), doc_->GetAllocator());
+		else
+			throw std::runtime_error('<' + std::string(element) + "> failed to parse '" + std::string(text) + "' as a boolean");
+	}
+	
+	void add_string(frame& f, str_view element, str_view text)
+	{
+		f.val_->AddMember(pool_.name(element), rapidjson::Value(text.data(), text.size(), doc_->GetAllocator()), doc_->GetAllocator());
+	}
+	
+	// Adds text from the input, which outlives the document in zero-copy mode
+	void add_text(frame& f, str_view element, str_view text)
+	{
+		if (g_zero_copy)
+			f.val_->AddMember(pool_.name(element), rapidjson::Value(rapidjson::StringRef(text.data(), text.size())), doc_->GetAllocator());
+		else
+			add_string(f, element, text);
+	}
+	
+	void add_symbol(rapidjson::Value& obj, str_view element, str_view text)
+	{
+		obj.AddMember(pool_.name(element), pool_.value(text), doc_->GetAllocator());
 	}
 };
 
-static const ofx_cont ofx_margininterest = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "TOTAL", ofx_cont::number },
-		{ "SUBACCTFUND", ofx_cont::string },
+// Only checks that values parse, for --validate
+struct validate_sink
+{
+	struct frame {};
+	
+	unsigned errors_ = 0;
+	
+	void open(frame&, frame*, const std::string&, const ofx_cont*) {}
+	void close(frame&, frame*, const ofx_cont*, const std::string&, const ofx_cont*) {}
+	
+	void tag(frame&, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		struct tm tm;
+		unsigned int msecs;
+		int tzoff_min;
+		double dval;
+		bool bval;
+		bool ok = true;
+		switch (fmt)
+		{
+			case ofx_cont::number:
+				ok = parse_float(text, dval);
+				break;
+			case ofx_cont::amount:
+				ok = parse_number(text, dval);
+				break;
+			case ofx_cont::boolean:
+				ok = parse_bool(text, bval);
+				break;
+			case ofx_cont::datetime:
+				ok = parse_datetime(text, tm, msecs, tzoff_min);
+				break;
+			default:
+				break;
+		}
+		if (!ok)
+		{
+			logErr('<' << element << "> invalid value '" << text << "'");
+			errors_++;
+		}
 	}
 };
 
-static const ofx_cont ofx_reinvest = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "INCOMETYPE", ofx_cont::string },
-		{ "TOTAL", ofx_cont::number },
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "COMMISSION", ofx_cont::number },
-		{ "TAXES", ofx_cont::number },
-		{ "FEES", ofx_cont::number },
-		{ "LOAD", ofx_cont::number },
-		{ "TAXEXEMPT", ofx_cont::boolean },
-		{ "INV401KSOURCE", ofx_cont::string },
+template <typename Sink> struct ofx_container;
+
+template <typename Sink>
+struct process_ctx
+{
+	Sink& sink_;
+	std::list<std::unique_ptr<ofx_container<Sink>>> ostack_;
+	
+	process_ctx(Sink& sink):
+		sink_(sink)
+	{
+	}
+	
+	void push_container(ofx_container<Sink> *container)
+	{
+		ostack_.push_front(std::unique_ptr<ofx_container<Sink>>(container));
+	}
+	
+	void pop_container()
+	{
+		ostack_.pop_front();
 	}
 };
 
-static const ofx_cont ofx_retofcap = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
-	tags: {
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "SUBACCTFUND", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
-		{ "INV401KSOURCE", ofx_cont::string },
+// Tracks the open aggregates and passes their contents to the sink, which is
+// a template parameter so that each output gets its own inlined instantiation
+template <typename Sink>
+struct ofx_container
+{
+	const std::string name_;
+	const cont_index * const index_;
+	const ofx_cont * const cont_;
+	process_ctx<Sink>& pctx_;
+	typename Sink::frame frame_;
+	std::vector<str_view> tags_;
+	
+	ofx_container(const std::string& name, const cont_index *index, process_ctx<Sink>& pctx):
+		name_(name),
+		index_(index),
+		cont_(index->cont_),
+		pctx_(pctx)
+	{
+		pctx_.sink_.open(frame_, parent() ? &parent()->frame_ : nullptr, name_, cont_);
+	}
+	
+	// The enclosing container, only valid until this one is pushed
+	ofx_container* parent() const
+	{
+		return !pctx_.ostack_.empty() ? pctx_.ostack_.front().get() : nullptr;
+	}
+	
+	void done()
+	{
+		assert(!pctx_.ostack_.empty());
+		auto it = pctx_.ostack_.begin();
+		assert(it->get() == this);
+		if (++it != pctx_.ostack_.end())
+		{
+			auto pcontainer = it->get();
+			pctx_.sink_.close(frame_, &pcontainer->frame_, pcontainer->cont_, name_, cont_);
+		}
+		else
+			pctx_.sink_.close(frame_, nullptr, nullptr, name_, cont_);
+	}
+	
+	bool handle_tag(str_view element, uint32_t hash, const std::map<std::string, std::string>& /*attrs*/, str_view text)
+	{
+		auto entry = index_->lookup(element, hash);
+		if (entry && entry->sub_)
+		{
+			pctx_.push_container(new ofx_container(*entry->name_, entry->sub_, pctx_));
+		}
+		else
+		{
+			if (entry)
+				pctx_.sink_.tag(frame_, element, entry->fmt_, text);
+			else
+				logErr('<' << name_ << "> unhandled element: '" << element << "' text: '" << text << "'");
+			tags_.push_back(element);
+		}
+		return true;
+	}
+	
+	bool handle_close(str_view close_tag, bool& container_done)
+	{
+		bool found = false;
+		while (!tags_.empty() && !found)
+		{
+			if (name_equals(tags_.back(), close_tag))
+				found = true;
+			tags_.pop_back();
+		}
+		if (tags_.empty() && name_equals(close_tag, name_))
+		{
+			container_done = true;
+			return true;
+		}
+		
+		return found;
 	}
 };
 
-static const ofx_cont ofx_split = {
+static const ofx_cont ofx_status = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
-		{ "ORIGCURRENCY", &ofx_currency },
-	},
+	sub: {},
 	tags: {
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "OLDUNITS", ofx_cont::number },
-		{ "NEWUNITS", ofx_cont::number },
-		{ "NUMERATOR", ofx_cont::number },
-		{ "DENOMINATOR", ofx_cont::number },
-		{ "FRACCASH", ofx_cont::number },
-		{ "SUBACCTFUND", ofx_cont::string },
-		{ "INV401KSOURCE", ofx_cont::string },
-	}
+		{ "CODE", ofx_cont::symbol },
+		{ "SEVERITY", ofx_cont::symbol },
+		{ "MESSAGE", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_transfer = {
+static const ofx_cont ofx_signon_sonrs_fi = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVTRAN", &ofx_invtran },
-		{ "SECID", &ofx_secid },
-		{ "INVACCTFROM", &ofx_invacctfrom },
-		
-	},
+	sub: {},
 	tags: {
-		{ "SUBACCTSEC", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
-		{ "TFERACTION", ofx_cont::string },
-		{ "POSTYPE", ofx_cont::string },
-		{ "AVGCOSTBASIS", ofx_cont::number },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "DTPURCHASE", ofx_cont::datetime },
-		{ "INV401KSOURCE", ofx_cont::string },
-	}
+		{ "ORG", ofx_cont::string },
+		{ "FID", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmttrnrs_invstmtrs_invtranlist = {
+static const ofx_cont ofx_signon_sonrs = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "INVBANKTRAN", &ofx_invstmttrnrs_invstmtrs_invtranlist_invbanktran },
-		{ "BUYDEBT", &ofx_buydebt },
-		{ "BUYMF", &ofx_buymf },
-		{ "BUYOPT", &ofx_buyopt },
-		{ "BUYOTHER", &ofx_buyother },
-		{ "BUYSTOCK", &ofx_buystock },
-		{ "CLOSUREOPT", &ofx_closureopt },
-		{ "INCOME", &ofx_income },
-		{ "INVEXPENSE", &ofx_invexpense },
-		{ "JRNLFUND", &ofx_jrnlfund },
-		{ "JRNLSEC", &ofx_jrnlsec },
-		{ "MARGININTEREST", &ofx_margininterest },
-		{ "REINVEST", &ofx_reinvest },
-		{ "RETOFCAP", &ofx_retofcap },
-		{ "SELLDEBT", &ofx_selldebt },
-		{ "SELLMF", &ofx_sellmf },
-		{ "SELLOPT", &ofx_sellopt },
-		{ "SELLOTHER", &ofx_sellother },
-		{ "SELLSTOCK", &ofx_sellstock },
-		{ "SPLIT", &ofx_split },
-		{ "TRANSFER", &ofx_transfer },
+		{ "STATUS", &ofx_status },
+		{ "FI", &ofx_signon_sonrs_fi },
 	},
 	tags: {
-		{ "DTSTART", ofx_cont::datetime },
-		{ "DTEND", ofx_cont::datetime },
-	}
+		{ "DTSERVER", ofx_cont::datetime },
+		{ "DTPROFUP", ofx_cont::datetime },
+		{ "LANGUAGE", ofx_cont::symbol },
+		{ "SESSCOOKIE", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invpos = {
+static const ofx_cont ofx_signonmsgsrsv1 = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "SECID", &ofx_secid },
-		{ "CURRENCY", &ofx_currency },
+		{ "SONRS", &ofx_signon_sonrs },
 	},
-	tags: {
-		{ "HELDINACCT", ofx_cont::string },
-		{ "POSTYPE", ofx_cont::string },
-		{ "UNITS", ofx_cont::number },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "MKTVAL", ofx_cont::number },
-		{ "AVGCOSTBASIS", ofx_cont::number },
-		{ "DTPRICEASOF", ofx_cont::datetime },
-		{ "MEMO", ofx_cont::string },
-		{ "INV401KSOURCE", ofx_cont::string },
-	}
+	tags: {},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_posdebt = {
+static const ofx_cont ofx_signupmsgsrsv1 = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVPOS", &ofx_invpos },
-	},
-	tags: {}
+	sub: {}, // TODO
+	tags: {}, // TODO
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_posmf = {
+static const ofx_cont ofx_investment_entry_status = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVPOS", &ofx_invpos },
-	},
+	sub: {},
 	tags: {
-		{ "UNITSSTREET", ofx_cont::number },
-		{ "UNITSUSER", ofx_cont::number },
-		{ "REINVDIV", ofx_cont::boolean },
-		{ "REINVCG", ofx_cont::boolean },
-	}
+		{ "CODE", ofx_cont::symbol },
+		{ "SEVERITY", ofx_cont::symbol },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_posopt = {
+static const ofx_cont ofx_invacctfrom = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVPOS", &ofx_invpos },
-	},
+	sub: {},
 	tags: {
-		{ "SECURED", ofx_cont::string },
-	}
+		{ "BROKERID", ofx_cont::symbol },
+		{ "ACCTID", ofx_cont::symbol },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_posother = {
+static const ofx_cont ofx_currency = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVPOS", &ofx_invpos },
+	sub: {},
+	tags: {
+		{ "CURRATE", ofx_cont::symbol },
+		{ "CURSYM", ofx_cont::symbol },
 	},
-	tags: {}
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_posstock = {
+static const ofx_cont ofx_escrwamt = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "INVPOS", &ofx_invpos },
 	},
 	tags: {
-		{ "UNITSSTREET", ofx_cont::number },
-		{ "UNITSUSER", ofx_cont::number },
-		{ "REINVDIV", ofx_cont::boolean },
-	}
+		{ "ESCRWTOTAL", ofx_cont::amount },
+		{ "ESCRWTAX", ofx_cont::amount },
+		{ "ESCRWINS", ofx_cont::amount },
+		{ "ESCRWPMI", ofx_cont::amount },
+		{ "ESCRWFEES", ofx_cont::amount },
+		{ "ESCRWOTHER", ofx_cont::amount },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmttrnrs_invstmtrs_invposlist = {
+static const ofx_cont ofx_payee = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "POSMF", &ofx_posmf },
-		{ "POSSTOCK", &ofx_posstock },
-		{ "POSDEBT", &ofx_posdebt },
-		{ "POSOPT", &ofx_posopt },
-		{ "POSOTHER", &ofx_posother },
 	},
-	tags: {}
+	tags: {
+		{ "NAME", ofx_cont::symbol },
+		{ "ADDR1", ofx_cont::string },
+		{ "ADDR2", ofx_cont::string },
+		{ "ADDR3", ofx_cont::string },
+		{ "CITY", ofx_cont::string },
+		{ "STATE", ofx_cont::string },
+		{ "POSTALCODE", ofx_cont::string },
+		{ "COUNTRY", ofx_cont::string },
+		{ "PHONE", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmttrnrs_invstmtrs_invbal = {
+static const ofx_cont ofx_bankacctto = {
 	serialize: ofx_cont::object,
-	sub: {
-		// todo
-	},
+	sub: {},
 	tags: {
-		{ "AVAILCASH", ofx_cont::number },
-		{ "MARGINBALANCE", ofx_cont::number },
-		{ "SHORTBALANCE", ofx_cont::number },
-		// todo
-	}
+		{ "BANKID", ofx_cont::symbol },
+		{ "BRANCHID", ofx_cont::string },
+		{ "ACCTID", ofx_cont::symbol },
+		{ "ACCTTYPE", ofx_cont::symbol },
+		{ "ACCTKEY", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmttrnrs_invstmtrs = {
+
+static const ofx_cont ofx_ccacct_fromorto = {
 	serialize: ofx_cont::object,
-	sub: {
-		{ "INVACCTFROM", &ofx_invacctfrom },
-		{ "INVTRANLIST", &ofx_invstmttrnrs_invstmtrs_invtranlist },
-		{ "INVPOSLIST", &ofx_invstmttrnrs_invstmtrs_invposlist },
-		{ "INVBAL", &ofx_invstmttrnrs_invstmtrs_invbal},
-	//	{ "INVOOLIST", },
-	//	{ "INV401K", },
-	//	{ "INV401KBAL", }
-	},
+	sub: {},
 	tags: {
-		{ "DTASOF", ofx_cont::datetime },
-		{ "CURDEF", ofx_cont::string },
-		{ "MKTGINFO", ofx_cont::string },
-	}
+		{ "ACCTID", ofx_cont::symbol },
+		{ "ACCTKEY", ofx_cont::string },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmtmsgsrsv1_invstmttrnrs = {
-	serialize: ofx_cont::object_with_name_in_array,
+static const ofx_cont ofx_loanpmtinfo = {
+	serialize: ofx_cont::object,
 	sub: {
-		{ "STATUS", &ofx_status },
-		{ "INVSTMTRS", &ofx_invstmttrnrs_invstmtrs },
+		{ "ESCRWAMT", &ofx_escrwamt },
 	},
 	tags: {
-		{ "TRNUID", ofx_cont::string },
-		{ "CLTCOOKIE", ofx_cont::string },
-	}
+		{ "PRINAMT", ofx_cont::amount },
+		{ "INTAMT", ofx_cont::amount },
+		{ "INSURANCE", ofx_cont::amount },
+		{ "LATEFEEAMT", ofx_cont::amount },
+		{ "OTHERAMT", ofx_cont::amount },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_invstmtmsgsrsv1 = {
-	serialize: ofx_cont::array,
-	sub: {
-		{ "INVSTMTTRNRS", &ofx_invstmtmsgsrsv1_invstmttrnrs },
-	//	{ "INVMAILTRNRS", },
-	//	{ "INVMAILSYNCRS", },
-	//	{ "INVSTMTENDTRNRS", },
+static const ofx_cont ofx_imagedata = {
+	serialize: ofx_cont::object,
+	sub: {},
+	tags: {
+		{ "IMAGETYPE", ofx_cont::symbol },
+		{ "IMAGEREF", ofx_cont::string },
+		{ "IMAGEREFTYPE", ofx_cont::symbol },
+		{ "IMAGEDELAY", ofx_cont::string },
+		{ "DTIMAGEAVAIL", ofx_cont::string },
+		{ "IMAGETTL", ofx_cont::string },
+		{ "CHECKSUP", ofx_cont::string },
 	},
-	tags: {} // TODO
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_secinfo = {
+static const ofx_cont ofx_stmttrn = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "SECID", &ofx_secid },
+		{ "LOANPMTINFO", &ofx_loanpmtinfo },
+		{ "PAYEE", &ofx_payee },
+		{ "BANKACCTTO", &ofx_bankacctto },
+		{ "CCACCTTO", &ofx_ccacct_fromorto },
+		{ "IMAGEDATA", &ofx_imagedata },
 		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
 	},
 	tags: {
-		{ "SECNAME", ofx_cont::string },
-		{ "TICKER", ofx_cont::string },
-		{ "FIID", ofx_cont::string },
-		{ "RATING", ofx_cont::string },
-		{ "UNITPRICE", ofx_cont::number },
-		{ "DTASOF", ofx_cont::datetime },
+		{ "TRNTYPE", ofx_cont::symbol },
+		{ "DTPOSTED", ofx_cont::datetime },
+		{ "DTUSER", ofx_cont::datetime },
+		{ "DTAVAIL", ofx_cont::datetime },
+		{ "TRNAMT", ofx_cont::amount },
+		{ "FITID", ofx_cont::string },
+		{ "CORRECTFITID", ofx_cont::string },
+		{ "CORRECTACTION", ofx_cont::symbol },
+		{ "SRVRTID", ofx_cont::string },
+		{ "CHECKNUM", ofx_cont::string },
+		{ "REFNUM", ofx_cont::string },
+		{ "SIC", ofx_cont::symbol },
+		{ "PAYEEID", ofx_cont::string },
+		{ "NAME", ofx_cont::symbol },
+		{ "EXTDNAME", ofx_cont::string },
 		{ "MEMO", ofx_cont::string },
-	}
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
 };
 
-static const ofx_cont ofx_seclistmsgsrsv1_seclist_debtinfo = {
+// STMTTRN before images and loan payments were added in 1.6 and 2.1.1
+static const ofx_cont ofx_stmttrn_v1 = {
 	serialize: ofx_cont::object,
 	sub: {
-		{ "SECINFO", &ofx_secinfo },
+		{ "PAYEE", &ofx_payee },
+		{ "BANKACCTTO", &ofx_bankacctto },
+		{ "CCACCTTO", &ofx_ccacct_fromorto },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
 	},
+	tags: ofx_stmttrn.tags,
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_secid = {
+	serialize: ofx_cont::object,
+	sub: {},
 	tags: {
-		{ "PARVALUE", ofx_cont::number },
-		{ "DEBTTYPE", ofx_cont::string },
-		{ "DEBTCLASS", ofx_cont::string },
-		{ "COUPONRT", ofx_cont::number },
-		{ "DTCOUPON", ofx_cont::datetime },
-		{ "COUPONFREQ", ofx_cont::datetime },
-		{ "CALLPRICE", ofx_cont::number },
-		{ "YIELDTOCALL", ofx_cont::number },
-		{ "DTCALL", ofx_cont::datetime },
-		{ "CALLTYPE", ofx_cont::string },
-		{ "YIELDTOMAT", ofx_cont::string },
-		{ "DTMAT", ofx_cont::datetime },
-		{ "ASSETCLASS", ofx_cont::string },
-		{ "FIASSETCLASS", ofx_cont::string },
+		{ "UNIQUEID", ofx_cont::symbol },
+		{ "UNIQUEIDTYPE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invtran = {
+	serialize: ofx_cont::object,
+	sub: {},
+	tags: {
+		{ "FITID", ofx_cont::string },
+		{ "SRVRTID", ofx_cont::string },
+		{ "DTTRADE", ofx_cont::datetime },
+		{ "DTSETTLE", ofx_cont::datetime },
+		{ "REVERSALFITID", ofx_cont::string },
+		{ "MEMO", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invbuy = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+	},
+	tags: {
+		{ "UNITS", ofx_cont::number },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "TOTAL", ofx_cont::amount },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invsell = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "UNITS", ofx_cont::number },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "MARKDOWN", ofx_cont::amount },
+		{ "COMMISSION", ofx_cont::amount },
+		{ "TAXES", ofx_cont::amount },
+		{ "FEES", ofx_cont::amount },
+		{ "LOAD", ofx_cont::amount },
+		{ "WITHHOLDING", ofx_cont::amount },
+		{ "TAXEXEMPT", ofx_cont::boolean },
+		{ "TOTAL", ofx_cont::amount },
+		{ "GAIN", ofx_cont::amount },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+		{ "LOANID", ofx_cont::string },
+		{ "STATEWITHHOLDING", ofx_cont::amount },
+		{ "PENALTY", ofx_cont::amount },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmttrnrs_invstmtrs_invtranlist_invbanktran = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "STMTTRN", &ofx_stmttrn },
+	},
+	tags: {
+		{ "SUBACCTFUND", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_selldebt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVSELL", &ofx_invsell },
+	},
+	tags: {
+		{ "SELLREASON", ofx_cont::symbol },
+		{ "ACCRDINT", ofx_cont::amount },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_sellmf = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVSELL", &ofx_invsell },
+	},
+	tags: {
+		{ "SELLTYPE", ofx_cont::symbol },
+		{ "AVGCOSTBASIS", ofx_cont::amount },
+		{ "RELFITID", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_sellopt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVSELL", &ofx_invsell },
+	},
+	tags: {
+		{ "OPTSELLTYPE", ofx_cont::symbol },
+		{ "SHPERCTRCT", ofx_cont::number },
+		{ "RELFITID", ofx_cont::string },
+		{ "RELTYPE", ofx_cont::symbol },
+		{ "SECURED", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_sellother = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVSELL", &ofx_invsell },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_sellstock = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVSELL", &ofx_invsell },
+	},
+	tags: {
+		{ "SELLTYPE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_buydebt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBUY", &ofx_invbuy },
+	},
+	tags: {
+		{ "ACCRDINT", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_buymf = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBUY", &ofx_invbuy },
+	},
+	tags: {
+		{ "BUYTYPE", ofx_cont::symbol },
+		{ "RELFITID", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_buyopt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBUY", &ofx_invbuy },
+	},
+	tags: {
+		{ "OPTBUYTYPE", ofx_cont::symbol },
+		{ "SHPERCTRCT", ofx_cont::number },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_buyother = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBUY", &ofx_invbuy },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_buystock = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBUY", &ofx_invbuy },
+	},
+	tags: {
+		{ "BUYTYPE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_closureopt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+	},
+	tags: {
+		{ "OPTACTION", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+		{ "SHPERCTRCT", ofx_cont::number },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "RELFITID", ofx_cont::string },
+		{ "GAIN", ofx_cont::amount },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_income = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "INCOMETYPE", ofx_cont::symbol },
+		{ "TOTAL", ofx_cont::amount },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+		{ "TAXEXEMPT", ofx_cont::boolean },
+		{ "WITHHOLDING", ofx_cont::amount },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invexpense = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "TOTAL", ofx_cont::amount },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_jrnlfund = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+	},
+	tags: {
+		{ "SUBACCTTO", ofx_cont::symbol },
+		{ "SUBACCTFROM", ofx_cont::symbol },
+		{ "TOTAL", ofx_cont::amount },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_jrnlsec = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+	},
+	tags: {
+		{ "SUBACCTTO", ofx_cont::symbol },
+		{ "SUBACCTFROM", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_margininterest = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "TOTAL", ofx_cont::amount },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_reinvest = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "INCOMETYPE", ofx_cont::symbol },
+		{ "TOTAL", ofx_cont::amount },
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "COMMISSION", ofx_cont::amount },
+		{ "TAXES", ofx_cont::amount },
+		{ "FEES", ofx_cont::amount },
+		{ "LOAD", ofx_cont::amount },
+		{ "TAXEXEMPT", ofx_cont::boolean },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_retofcap = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_split = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+		{ "ORIGCURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "OLDUNITS", ofx_cont::number },
+		{ "NEWUNITS", ofx_cont::number },
+		{ "NUMERATOR", ofx_cont::number },
+		{ "DENOMINATOR", ofx_cont::number },
+		{ "FRACCASH", ofx_cont::amount },
+		{ "SUBACCTFUND", ofx_cont::symbol },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_transfer = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVTRAN", &ofx_invtran },
+		{ "SECID", &ofx_secid },
+		{ "INVACCTFROM", &ofx_invacctfrom },
+		
+	},
+	tags: {
+		{ "SUBACCTSEC", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+		{ "TFERACTION", ofx_cont::symbol },
+		{ "POSTYPE", ofx_cont::symbol },
+		{ "AVGCOSTBASIS", ofx_cont::amount },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "DTPURCHASE", ofx_cont::datetime },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmttrnrs_invstmtrs_invtranlist = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVBANKTRAN", &ofx_invstmttrnrs_invstmtrs_invtranlist_invbanktran },
+		{ "BUYDEBT", &ofx_buydebt },
+		{ "BUYMF", &ofx_buymf },
+		{ "BUYOPT", &ofx_buyopt },
+		{ "BUYOTHER", &ofx_buyother },
+		{ "BUYSTOCK", &ofx_buystock },
+		{ "CLOSUREOPT", &ofx_closureopt },
+		{ "INCOME", &ofx_income },
+		{ "INVEXPENSE", &ofx_invexpense },
+		{ "JRNLFUND", &ofx_jrnlfund },
+		{ "JRNLSEC", &ofx_jrnlsec },
+		{ "MARGININTEREST", &ofx_margininterest },
+		{ "REINVEST", &ofx_reinvest },
+		{ "RETOFCAP", &ofx_retofcap },
+		{ "SELLDEBT", &ofx_selldebt },
+		{ "SELLMF", &ofx_sellmf },
+		{ "SELLOPT", &ofx_sellopt },
+		{ "SELLOTHER", &ofx_sellother },
+		{ "SELLSTOCK", &ofx_sellstock },
+		{ "SPLIT", &ofx_split },
+		{ "TRANSFER", &ofx_transfer },
+	},
+	tags: {
+		{ "DTSTART", ofx_cont::datetime },
+		{ "DTEND", ofx_cont::datetime },
+	},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_invpos = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "HELDINACCT", ofx_cont::symbol },
+		{ "POSTYPE", ofx_cont::symbol },
+		{ "UNITS", ofx_cont::number },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "MKTVAL", ofx_cont::amount },
+		{ "AVGCOSTBASIS", ofx_cont::amount },
+		{ "DTPRICEASOF", ofx_cont::datetime },
+		{ "MEMO", ofx_cont::string },
+		{ "INV401KSOURCE", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_posdebt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVPOS", &ofx_invpos },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_posmf = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVPOS", &ofx_invpos },
+	},
+	tags: {
+		{ "UNITSSTREET", ofx_cont::number },
+		{ "UNITSUSER", ofx_cont::number },
+		{ "REINVDIV", ofx_cont::boolean },
+		{ "REINVCG", ofx_cont::boolean },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_posopt = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVPOS", &ofx_invpos },
+	},
+	tags: {
+		{ "SECURED", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_posother = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVPOS", &ofx_invpos },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_posstock = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVPOS", &ofx_invpos },
+	},
+	tags: {
+		{ "UNITSSTREET", ofx_cont::number },
+		{ "UNITSUSER", ofx_cont::number },
+		{ "REINVDIV", ofx_cont::boolean },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmttrnrs_invstmtrs_invposlist = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "POSMF", &ofx_posmf },
+		{ "POSSTOCK", &ofx_posstock },
+		{ "POSDEBT", &ofx_posdebt },
+		{ "POSOPT", &ofx_posopt },
+		{ "POSOTHER", &ofx_posother },
+	},
+	tags: {},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_invstmttrnrs_invstmtrs_invbal = {
+	serialize: ofx_cont::object,
+	sub: {
+		// todo
+	},
+	tags: {
+		{ "AVAILCASH", ofx_cont::amount },
+		{ "MARGINBALANCE", ofx_cont::amount },
+		{ "SHORTBALANCE", ofx_cont::amount },
+		// todo
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmttrnrs_invstmtrs = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "INVACCTFROM", &ofx_invacctfrom },
+		{ "INVTRANLIST", &ofx_invstmttrnrs_invstmtrs_invtranlist },
+		{ "INVPOSLIST", &ofx_invstmttrnrs_invstmtrs_invposlist },
+		{ "INVBAL", &ofx_invstmttrnrs_invstmtrs_invbal},
+	//	{ "INVOOLIST", },
+	//	{ "INV401K", },
+	//	{ "INV401KBAL", }
+	},
+	tags: {
+		{ "DTASOF", ofx_cont::datetime },
+		{ "CURDEF", ofx_cont::symbol },
+		{ "MKTGINFO", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmtmsgsrsv1_invstmttrnrs = {
+	serialize: ofx_cont::object_with_name_in_array,
+	sub: {
+		{ "STATUS", &ofx_status },
+		{ "INVSTMTRS", &ofx_invstmttrnrs_invstmtrs },
+	},
+	tags: {
+		{ "TRNUID", ofx_cont::string },
+		{ "CLTCOOKIE", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_invstmtmsgsrsv1 = {
+	serialize: ofx_cont::array,
+	sub: {
+		{ "INVSTMTTRNRS", &ofx_invstmtmsgsrsv1_invstmttrnrs },
+	//	{ "INVMAILTRNRS", },
+	//	{ "INVMAILSYNCRS", },
+	//	{ "INVSTMTENDTRNRS", },
+	},
+	tags: {}, // TODO
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_secinfo = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "SECID", &ofx_secid },
+		{ "CURRENCY", &ofx_currency },
+	},
+	tags: {
+		{ "SECNAME", ofx_cont::string },
+		{ "TICKER", ofx_cont::string },
+		{ "FIID", ofx_cont::string },
+		{ "RATING", ofx_cont::string },
+		{ "UNITPRICE", ofx_cont::number },
+		{ "DTASOF", ofx_cont::datetime },
+		{ "MEMO", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_seclistmsgsrsv1_seclist_debtinfo = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "SECINFO", &ofx_secinfo },
+	},
+	tags: {
+		{ "PARVALUE", ofx_cont::amount },
+		{ "DEBTTYPE", ofx_cont::symbol },
+		{ "DEBTCLASS", ofx_cont::symbol },
+		{ "COUPONRT", ofx_cont::number },
+		{ "DTCOUPON", ofx_cont::datetime },
+		{ "COUPONFREQ", ofx_cont::datetime },
+		{ "CALLPRICE", ofx_cont::number },
+		{ "YIELDTOCALL", ofx_cont::number },
+		{ "DTCALL", ofx_cont::datetime },
+		{ "CALLTYPE", ofx_cont::symbol },
+		{ "YIELDTOMAT", ofx_cont::string },
+		{ "DTMAT", ofx_cont::datetime },
+		{ "ASSETCLASS", ofx_cont::symbol },
+		{ "FIASSETCLASS", ofx_cont::symbol },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_mfassetclass_portion = {
+	serialize: ofx_cont::object,
+	sub: {},
+	tags: {
+		{ "ASSETCLASS", ofx_cont::symbol },
+		{ "PERCENT", ofx_cont::number },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_mfassetclass = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "PORTION", &ofx_mfassetclass_portion },
+	},
+	tags: {},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_fimfassetclass_portion = {
+	serialize: ofx_cont::object,
+	sub: {},
+	tags: {
+		{ "FIASSETCLASS", ofx_cont::symbol },
+		{ "PERCENT", ofx_cont::number },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_fimfassetclass = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "FIPORTION", &ofx_fimfassetclass_portion },
+	},
+	tags: {},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_seclistmsgsrsv1_seclist_mfinfo = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "SECINFO", &ofx_secinfo },
+		{ "MFASSETCLASS", &ofx_mfassetclass },
+		{ "FIMFASSETCLASS", &ofx_fimfassetclass },
+	},
+	tags: {
+		{ "MFTYPE", ofx_cont::symbol },
+		{ "YIELD", ofx_cont::number },
+		{ "DTYIELDASOF", ofx_cont::datetime },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_seclistmsgsrsv1_seclist = {
+	serialize: ofx_cont::object_with_name_in_array,
+	sub: {
+		{ "DEBTINFO", &ofx_seclistmsgsrsv1_seclist_debtinfo },
+		{ "MFINFO", &ofx_seclistmsgsrsv1_seclist_mfinfo },
+	//	{ "OPTINFO", &ofx_seclistmsgsrsv1_seclist_optinfo },
+	//	{ "OTHERINFO", &ofx_seclistmsgsrsv1_seclist_otherinfo },
+	//	{ "STOCKINFO", &ofx_seclistmsgsrsv1_seclist_stockinfo },
+	},
+	tags: {},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_seclistmsgsrsv1 = {
+	serialize: ofx_cont::array,
+	sub: {
+		{ "SECLIST", &ofx_seclistmsgsrsv1_seclist },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_banktranlist = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "STMTTRN", &ofx_stmttrn },
+	},
+	tags: {
+		{ "DTSTART", ofx_cont::datetime },
+		{ "DTEND", ofx_cont::datetime },
+	},
+	sub_arrays: true
+};
+
+static const ofx_cont ofx_bal = {
+	serialize: ofx_cont::object,
+	sub: {},
+	tags: {
+		{ "BALAMT", ofx_cont::amount },
+		{ "DTASOF", ofx_cont::datetime },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_stmtrs = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "BANKACCTFROM", &ofx_bankacctto },
+		{ "BANKTRANLIST", &ofx_banktranlist },
+		{ "LEDGERBAL", &ofx_bal },
+		{ "AVAILBAL", &ofx_bal },
+	},
+	tags: {
+		{ "CURDEF", ofx_cont::symbol },
+		{ "MKTGINFO", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_ccstmtrs = {
+	serialize: ofx_cont::object,
+	sub: {
+		{ "CCACCTFROM", &ofx_ccacct_fromorto },
+		{ "BANKTRANLIST", &ofx_banktranlist },
+		{ "LEDGERBAL", &ofx_bal },
+		{ "AVAILBAL", &ofx_bal },
+	},
+	tags: {
+		{ "CURDEF", ofx_cont::symbol },
+		{ "MKTGINFO", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_stmttrnrs = {
+	serialize: ofx_cont::object_with_name_in_array,
+	sub: {
+		{ "STATUS", &ofx_status },
+		{ "STMTRS", &ofx_stmtrs },
+	},
+	tags: {
+		{ "TRNUID", ofx_cont::string },
+		{ "CLTCOOKIE", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_ccstmttrnrs = {
+	serialize: ofx_cont::object_with_name_in_array,
+	sub: {
+		{ "STATUS", &ofx_status },
+		{ "CCSTMTRS", &ofx_ccstmtrs },
+	},
+	tags: {
+		{ "TRNUID", ofx_cont::string },
+		{ "CLTCOOKIE", ofx_cont::string },
+	},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_bankmsgsrsv1 = {
+	serialize: ofx_cont::array,
+	sub: {
+		{ "STMTTRNRS", &ofx_stmttrnrs },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_creditcardmsgsrsv1 = {
+	serialize: ofx_cont::array,
+	sub: {
+		{ "CCSTMTTRNRS", &ofx_ccstmttrnrs },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_cont ofx_main = {
+	serialize: ofx_cont::nothing,
+	sub: {
+		{ "SIGNONMSGSRSV1", &ofx_signonmsgsrsv1 },
+		{ "SIGNUPMSGSRSV1", &ofx_signupmsgsrsv1 },
+		{ "BANKMSGSRSV1", &ofx_bankmsgsrsv1 },
+		{ "CREDITCARDMSGSRSV1", &ofx_creditcardmsgsrsv1 },
+		{ "INVSTMTMSGSRSV1", &ofx_invstmtmsgsrsv1 },
+		{ "SECLISTMSGSRSV1", &ofx_seclistmsgsrsv1 },
+	},
+	tags: {},
+	sub_arrays: false
+};
+
+static const ofx_schema ofx_schemas[] = {
+	{ "1.0x", 100, 159, { { &ofx_stmttrn, &ofx_stmttrn_v1 } } },
+	{ "1.6", 160, 199, {} },
+	{ "2.0/2.1", 200, 210, { { &ofx_stmttrn, &ofx_stmttrn_v1 } } },
+	{ "2.1.1+", 211, 999, {} },
+};
+
+// Returns the VERSION from the SGML (VERSION:102) or XML (<?OFX VERSION="211"?>)
+// header, or 0 when there is none
+static unsigned ofx_header_version(str_view header)
+{
+	size_t pos = 0;
+	while ((pos = header.find("VERSION", pos)) != str_view::npos)
+	{
+		pos += 7;
+		skip_ws(header, pos);
+		if (pos < header.size() && (header[pos] == ':' || header[pos] == '='))
+		{
+			pos++;
+			skip_ws(header, pos);
+			if (pos < header.size() && header[pos] == '"')
+				pos++;
+			unsigned version;
+			if (parse_digits(header, pos, std::string::npos, version))
+				return version;
+		}
+	}
+	return 0;
+}
+
+// Copies the tables from cont down with the variants of schema swapped in.
+// Tables with no variant below them are shared with the full tables.
+static const ofx_cont* copy_schema_tables(const ofx_schema& schema, const ofx_cont* cont,
+	std::map<const ofx_cont*, const ofx_cont*>& done, std::vector<std::unique_ptr<ofx_cont>>& copies)
+{
+	auto it = done.find(cont);
+	if (it != done.end())
+		return it->second;
+	
+	const ofx_cont* ret = cont;
+	for (auto& v : schema.variants)
+		if (v.first == cont)
+			ret = v.second;
+	std::map<std::string, const ofx_cont*> sub;
+	bool changed = false;
+	for (auto& s : ret->sub)
+	{
+		const ofx_cont* copy = copy_schema_tables(schema, s.second, done, copies);
+		changed |= copy != s.second;
+		sub.emplace(s.first, copy);
+	}
+	if (changed)
+	{
+		copies.emplace_back(new ofx_cont{
+			serialize: ret->serialize,
+			sub: sub,
+			tags: ret->tags,
+			sub_arrays: ret->sub_arrays
+		});
+		ret = copies.back().get();
+	}
+	done[cont] = ret;
+	return ret;
+}
+
+// Builds the index of cont and of all tables below it
+static const cont_index* index_tables(const ofx_cont* cont, std::map<const ofx_cont*, cont_index>& indexes)
+{
+	auto it = indexes.find(cont);
+	if (it != indexes.end())
+		return &it->second;
+	
+	cont_index& index = indexes[cont];
+	index.cont_ = cont;
+	index.full_ = nullptr;
+	size_t size = 8;
+	while (size < (cont->sub.size() + cont->tags.size()) * 2)
+		size *= 2;
+	index.slots_.assign(size, cont_index::entry{0, nullptr, nullptr, ofx_cont::string});
+	auto insert = [&](const std::string& name, const cont_index* sub, ofx_cont::tag_fmt fmt)
+	{
+		uint32_t h = name_hash(name);
+		size_t s = h & (size - 1);
+		while (index.slots_[s].name_)
+			s = (s + 1) & (size - 1);
+		index.slots_[s] = cont_index::entry{h, &name, sub, fmt};
+	};
+	for (auto& it : cont->sub)
+		insert(it.first, index_tables(it.second, indexes), ofx_cont::string);
+	for (auto& it : cont->tags)
+		insert(it.first, nullptr, it.second);
+	return &index;
+}
+
+// Root table of the tables for the header VERSION.  The tables of every
+// schema and their indexes are built once, so a document only selects its
+// root.
+static const cont_index* schema_root(unsigned version)
+{
+	struct schema_tables
+	{
+		std::vector<std::unique_ptr<ofx_cont>> copies_;
+		std::map<const ofx_cont*, cont_index> indexes_;
+		std::vector<const cont_index*> roots_; // parallel to ofx_schemas
+		const cont_index* full_;
+		
+		schema_tables()
+		{
+			for (auto& schema : ofx_schemas)
+			{
+				std::map<const ofx_cont*, const ofx_cont*> done;
+				roots_.push_back(index_tables(copy_schema_tables(schema, &ofx_main, done, copies_), indexes_));
+				for (auto& it : done)
+				{
+					if (it.second != it.first)
+						indexes_[it.second].full_ = index_tables(it.first, indexes_);
+				}
+			}
+			full_ = index_tables(&ofx_main, indexes_);
+		}
+	};
+	static const schema_tables tables;
+	
+	for (size_t i = 0; i < tables.roots_.size(); i++)
+		if (version >= ofx_schemas[i].min_version && version <= ofx_schemas[i].max_version)
+			return tables.roots_[i];
+	return tables.full_;
+}
+
+template <typename Sink>
+static bool process_ofx(Sink& sink, std::string& in, size_t& pos)
+{
+	// pos points right after <OFX>, so everything before it is the header
+	process_ctx<Sink> pctx(sink);
+	
+	pctx.push_container(new ofx_container<Sink>("OFX", schema_root(ofx_header_version(str_view(in.data(), pos))), pctx));
+	
+	if (!iterate_elements(in, pos, g_zero_copy,
+		[&](str_view element, uint32_t hash, bool closing, const std::map<std::string, std::string>& attrs, str_view text) -> bool
+		{
+			if (!closing)
+			{
+				assert(!pctx.ostack_.empty());
+				auto& os_top = *pctx.ostack_.front();
+				return os_top.handle_tag(element, hash, attrs, text);
+			}
+			else
+			{
+				if (!pctx.ostack_.empty())
+				{
+					auto& os_top = *pctx.ostack_.front();
+					bool container_done = false;
+					if (!os_top.handle_close(element, container_done))
+					{
+						logErr("mismatch for /" << element << ", expecting /" << os_top.name_);
+						return false;
+					}
+					
+					if (container_done)
+					{
+						os_top.done();
+						pctx.ostack_.pop_front();
+					}
+				}
+				else
+				{
+					logErr("unexpected tag found: </" << element << '>');
+					return false;
+				}
+			}
+			
+			
+			return true;
+		}))
+	{
+		logErr("Processing failed.");
+		return true;
+	}
+	
+	if (pctx.ostack_.size() == 1)
+	{
+		auto& os_top = *pctx.ostack_.front();
+		bool container_done = false;
+		os_top.handle_close(os_top.name_, container_done);
+		if (container_done)
+			os_top.done();
+		pctx.ostack_.pop_front();
+		
+		if (!container_done)
+			return false;
+	}
+	
+	if (!pctx.ostack_.empty())
+	{
+		logErr("Stack not empty!");
+		return false;
+	}
+	
+	logDbg("Processing succeeded.");
+	return true;
+}
+
+// 128 bit FNV-1a hash, fed incrementally
+struct fingerprint128
+{
+	unsigned __int128 h_;
+	
+	fingerprint128():
+		h_(((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+	{
+	}
+	
+	void update(const void *data, size_t len)
+	{
+		static const unsigned __int128 prime = ((unsigned __int128)0x0000000001000000ULL << 64) | 0x000000000000013bULL;
+		const unsigned char *p = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < len; i++)
+		{
+			h_ ^= p[i];
+			h_ *= prime;
+		}
+	}
+	
+	void update(char kind, uint64_t val)
+	{
+		unsigned char buf[9];
+		buf[0] = kind;
+		for (int i = 0; i < 8; i++)
+			buf[1 + i] = (unsigned char)(val >> (8 * i));
+		update(buf, sizeof buf);
+	}
+	
+	void update(char kind, const char *str, size_t len)
+	{
+		update(kind, (uint64_t)len);
+		update(str, len);
+	}
+	
+	std::string hex() const
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string ret(32, '0');
+		unsigned __int128 h = h_;
+		for (int i = 31; i >= 0; i--, h >>= 4)
+			ret[i] = digits[(unsigned)h & 0xf];
+		return ret;
+	}
+};
+
+// Forwards the document to a writer while hashing it.  Every transaction
+// object and the document itself get a "fingerprint" member appended, so
+// that semantically identical (canonical) statements hash identically.
+// The fingerprint is the hash of the members before it, so it is only
+// known at the end of the object and deliberately trails the sorted
+// members instead of taking its sorted position.
+template <typename Handler>
+struct fingerprint_writer
+{
+	typedef char Ch;
+	
+	struct frame
+	{
+		bool txn_;       // object is a transaction
+		bool txn_elems_; // array of transactions
+		fingerprint128 hash_;
+	};
+	
+	Handler& out_;
+	std::unordered_multimap<uint32_t, str_view> txn_names_; // by name_hash, so that keys are not copied
+	std::vector<frame> stack_;
+	bool txn_key_;
+	
+	fingerprint_writer(Handler& out, const std::set<std::string>& txn_names):
+		out_(out),
+		txn_key_(false)
+	{
+		for (auto const& name : txn_names)
+			txn_names_.emplace(name_hash(name), name);
+	}
+	
+	bool txn_name(str_view name) const
+	{
+		auto range = txn_names_.equal_range(name_hash(name));
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == name)
+				return true;
+		}
+		return false;
+	}
+	
+	void feed(char kind, uint64_t val)
+	{
+		for (auto& f : stack_)
+		{
+			if (f.txn_ || &f == &stack_.front())
+				f.hash_.update(kind, val);
+		}
+	}
+	
+	void feed(char kind, const char *str, size_t len)
+	{
+		for (auto& f : stack_)
+		{
+			if (f.txn_ || &f == &stack_.front())
+				f.hash_.update(kind, str, len);
+		}
+	}
+	
+	void scalar()
+	{
+		txn_key_ = false;
+	}
+	
+	bool Null() { scalar(); feed('n', 0); return out_.Null(); }
+	bool Bool(bool b) { scalar(); feed('b', b); return out_.Bool(b); }
+	bool Int(int i) { scalar(); feed('i', (uint64_t)(int64_t)i); return out_.Int(i); }
+	bool Uint(unsigned u) { scalar(); feed('i', u); return out_.Uint(u); }
+	bool Int64(int64_t i) { scalar(); feed('i', (uint64_t)i); return out_.Int64(i); }
+	bool Uint64(uint64_t u) { scalar(); feed('u', u); return out_.Uint64(u); }
+	
+	bool Double(double d)
+	{
+		scalar();
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof bits);
+		feed('d', bits);
+		return out_.Double(d);
+	}
+	
+	bool RawNumber(const Ch *str, rapidjson::SizeType len, bool copy)
+	{
+		scalar();
+		feed('r', str, len);
+		return out_.RawNumber(str, len, copy);
+	}
+	
+	bool String(const Ch *str, rapidjson::SizeType len, bool copy)
+	{
+		scalar();
+		feed('s', str, len);
+		return out_.String(str, len, copy);
+	}
+	
+	bool Key(const Ch *str, rapidjson::SizeType len, bool copy)
+	{
+		txn_key_ = txn_name(str_view(str, len));
+		feed('k', str, len);
+		return out_.Key(str, len, copy);
+	}
+	
+	bool StartObject()
+	{
+		bool txn = txn_key_ || (!stack_.empty() && stack_.back().txn_elems_);
+		txn_key_ = false;
+		feed('{', 0);
+		stack_.push_back(frame{txn, false, fingerprint128()});
+		return out_.StartObject();
+	}
+	
+	bool EndObject(rapidjson::SizeType count)
+	{
+		assert(!stack_.empty());
+		frame f = stack_.back();
+		stack_.pop_back();
+		feed('}', count);
+		if (f.txn_ || stack_.empty())
+		{
+			std::string hex = f.hash_.hex();
+			if (!out_.Key("fingerprint", 11, false) || !out_.String(hex.c_str(), hex.size(), true))
+				return false;
+			count++;
+		}
+		return out_.EndObject(count);
+	}
+	
+	bool StartArray()
+	{
+		bool txn_elems = txn_key_;
+		txn_key_ = false;
+		feed('[', 0);
+		stack_.push_back(frame{false, txn_elems, fingerprint128()});
+		return out_.StartArray();
+	}
+	
+	bool EndArray(rapidjson::SizeType count)
+	{
+		assert(!stack_.empty());
+		stack_.pop_back();
+		feed(']', count);
+		return out_.EndArray(count);
+	}
+};
+
+// Writes the strings added by add_raw_number as raw JSON numbers
+template <typename Handler>
+struct raw_number_writer
+{
+	typedef char Ch;
+	
+	Handler& out_;
+	const std::unordered_set<const char*>& raw_;
+	
+	raw_number_writer(Handler& out, const std::unordered_set<const char*>& raw):
+		out_(out),
+		raw_(raw)
+	{
+	}
+	
+	bool Null() { return out_.Null(); }
+	bool Bool(bool b) { return out_.Bool(b); }
+	bool Int(int i) { return out_.Int(i); }
+	bool Uint(unsigned u) { return out_.Uint(u); }
+	bool Int64(int64_t i) { return out_.Int64(i); }
+	bool Uint64(uint64_t u) { return out_.Uint64(u); }
+	bool Double(double d) { return out_.Double(d); }
+	bool RawNumber(const Ch *str, rapidjson::SizeType len, bool copy) { return out_.RawNumber(str, len, copy); }
+	
+	bool String(const Ch *str, rapidjson::SizeType len, bool copy)
+	{
+		if (raw_.count(str))
+			return out_.RawValue(str, len, rapidjson::kNumberType);
+		return out_.String(str, len, copy);
+	}
+	
+	bool Key(const Ch *str, rapidjson::SizeType len, bool copy) { return out_.Key(str, len, copy); }
+	bool StartObject() { return out_.StartObject(); }
+	bool EndObject(rapidjson::SizeType count) { return out_.EndObject(count); }
+	bool StartArray() { return out_.StartArray(); }
+	bool EndArray(rapidjson::SizeType count) { return out_.EndArray(count); }
+};
+
+// JSON names of all transaction aggregates
+static const std::set<std::string>& transaction_names()
+{
+	static const std::set<std::string> names = []()
+	{
+		std::set<std::string> ret;
+		for (auto const& it : ofx_invstmttrnrs_invstmtrs_invtranlist.sub)
+			ret.insert(str_lower(it.first));
+		ret.insert("stmttrn");
+		return ret;
+	}();
+	return names;
+}
+
+// Lower case names of the position aggregates
+static const std::set<std::string>& position_names()
+{
+	static const std::set<std::string> names = []()
+	{
+		std::set<std::string> ret;
+		for (auto const& it : ofx_invstmttrnrs_invstmtrs_invposlist.sub)
+			ret.insert(str_lower(it.first));
+		return ret;
+	}();
+	return names;
+}
+
+// Passes every event on to two sinks, nest to attach more
+template <typename A, typename B>
+struct fanout_sink
+{
+	struct frame
+	{
+		typename A::frame a_;
+		typename B::frame b_;
+	};
+	
+	A& a_;
+	B& b_;
+	
+	fanout_sink(A& a, B& b):
+		a_(a),
+		b_(b)
+	{
+	}
+	
+	void open(frame& f, frame* parent, const std::string& name, const ofx_cont* cont)
+	{
+		a_.open(f.a_, parent ? &parent->a_ : nullptr, name, cont);
+		b_.open(f.b_, parent ? &parent->b_ : nullptr, name, cont);
+	}
+	
+	void close(frame& f, frame* parent, const ofx_cont* parent_cont, const std::string& name, const ofx_cont* cont)
+	{
+		a_.close(f.a_, parent ? &parent->a_ : nullptr, parent_cont, name, cont);
+		b_.close(f.b_, parent ? &parent->b_ : nullptr, parent_cont, name, cont);
+	}
+	
+	void tag(frame& f, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		a_.tag(f.a_, element, fmt, text);
+		b_.tag(f.b_, element, fmt, text);
+	}
+};
+
+// Writes one CSV row per transaction.  Values are taken from the elements
+// of the transaction aggregate and everything nested in it.
+struct csv_sink
+{
+	struct frame
+	{
+		bool row_ = false;
+	};
+	
+	enum column
+	{
+		col_type = 0,
+		col_fitid,
+		col_date,
+		col_trntype,
+		col_amount,
+		col_units,
+		col_unitprice,
+		col_security,
+		col_name,
+		col_memo,
+		col_count
+	};
+	
+	std::ostream& out_;
+	bool in_row_ = false;
+	std::string row_[col_count];
+	
+	csv_sink(std::ostream& out):
+		out_(out)
+	{
+		out_ << "type,fitid,date,trntype,amount,units,unitprice,security,name,memo\n";
+	}
+	
+	static int column_of(str_view element)
+	{
+		static const struct
+		{
+			const char *element;
+			column col;
+		} columns[] = {
+			{ "FITID", col_fitid },
+			{ "DTPOSTED", col_date },
+			{ "DTTRADE", col_date },
+			{ "TRNTYPE", col_trntype },
+			{ "BUYTYPE", col_trntype },
+			{ "SELLTYPE", col_trntype },
+			{ "INCOMETYPE", col_trntype },
+			{ "TRNAMT", col_amount },
+			{ "TOTAL", col_amount },
+			{ "UNITS", col_units },
+			{ "UNITPRICE", col_unitprice },
+			{ "UNIQUEID", col_security },
+			{ "NAME", col_name },
+			{ "MEMO", col_memo },
+		};
+		for (auto const& c : columns)
+		{
+			if (name_equals(element, c.element))
+				return c.col;
+		}
+		return -1;
+	}
+	
+	void write_field(const std::string& val)
+	{
+		if (val.find_first_of(",\"\r\n") == std::string::npos)
+		{
+			out_ << val;
+			return;
+		}
+		out_ << '"';
+		for (char ch : val)
+		{
+			if (ch == '"')
+				out_ << '"';
+			out_ << ch;
+		}
+		out_ << '"';
+	}
+	
+	void open(frame& f, frame*, const std::string& name, const ofx_cont*)
+	{
+		if (!in_row_ && transaction_names().count(str_lower(name)))
+		{
+			f.row_ = in_row_ = true;
+			for (auto& col : row_)
+				col.clear();
+			row_[col_type] = str_lower(name);
+		}
+	}
+	
+	void close(frame& f, frame*, const ofx_cont*, const std::string&, const ofx_cont*)
+	{
+		if (!f.row_)
+			return;
+		for (int i = 0; i < col_count; i++)
+		{
+			if (i)
+				out_ << ',';
+			write_field(row_[i]);
+		}
+		out_ << '\n';
+		in_row_ = false;
+	}
+	
+	void tag(frame&, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		if (!in_row_)
+			return;
+		int col = column_of(element);
+		if (col < 0 || !row_[col].empty())
+			return;
+		struct tm tm;
+		unsigned int msecs;
+		int tzoff_min;
+		double val;
+		char buf[64];
+		if (fmt == ofx_cont::datetime && parse_datetime(text, tm, msecs, tzoff_min))
+		{
+			format_datetime(buf, tm, msecs, tzoff_min);
+			row_[col] = buf;
+		}
+		else if ((fmt == ofx_cont::number || fmt == ofx_cont::amount) && !is_json_number(text) && parse_number(text, val))
+		{
+			snprintf(buf, sizeof buf, "%.15g", val);
+			row_[col] = buf;
+		}
+		else
+			row_[col] = std::string(text);
+	}
+};
+
+// Counts aggregates, values and transactions and the range of their dates
+struct stats_sink
+{
+	struct frame
+	{
+		bool txn_ = false;
+	};
+	
+	unsigned aggregates_ = 0;
+	unsigned values_ = 0;
+	unsigned transactions_ = 0;
+	bool in_txn_ = false;
+	std::map<std::string, unsigned> types_;
+	int64_t first_ = INT64_MAX;
+	int64_t last_ = INT64_MIN;
+	
+	void open(frame& f, frame*, const std::string& name, const ofx_cont*)
+	{
+		aggregates_++;
+		if (!in_txn_)
+		{
+			std::string lname = str_lower(name);
+			if (transaction_names().count(lname))
+			{
+				f.txn_ = in_txn_ = true;
+				transactions_++;
+				types_[lname]++;
+			}
+		}
+	}
+	
+	void close(frame& f, frame*, const ofx_cont*, const std::string&, const ofx_cont*)
+	{
+		if (f.txn_)
+			in_txn_ = false;
+	}
+	
+	void tag(frame&, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		values_++;
+		int64_t secs;
+		if (in_txn_ && fmt == ofx_cont::datetime && (name_equals(element, "DTPOSTED") || name_equals(element, "DTTRADE")) &&
+			parse_epoch(text, secs))
+		{
+			first_ = std::min(first_, secs);
+			last_ = std::max(last_, secs);
+		}
+	}
+	
+	void write(std::ostream& out)
+	{
+		rapidjson::StringBuffer sbuf;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(sbuf);
+		writer.StartObject();
+		writer.Key("aggregates");
+		writer.Uint(aggregates_);
+		writer.Key("values");
+		writer.Uint(values_);
+		writer.Key("transactions");
+		writer.Uint(transactions_);
+		writer.Key("types");
+		writer.StartObject();
+		for (auto const& t : types_)
+		{
+			writer.Key(t.first.c_str(), t.first.size());
+			writer.Uint(t.second);
+		}
+		writer.EndObject();
+		if (first_ <= last_)
+		{
+			writer.Key("first");
+			writer.String(format_time(first_).c_str());
+			writer.Key("last");
+			writer.String(format_time(last_).c_str());
+		}
+		writer.EndObject();
+		out << sbuf.GetString() << std::endl;
+	}
+};
+
+// Values of one transaction, for the analysis modes.  Each field records
+// the aggregate it was found in, e.g. SECID for UNIQUEID.
+struct txn_record
+{
+	struct field
+	{
+		std::string agg_;
+		std::string name_;
+		std::string value_;
+	};
+	
+	std::string type_; // lower case aggregate name, e.g. "buystock"
+	std::string acct_; // ACCTID of the statement
+	std::string curdef_; // CURDEF of the statement
+	std::vector<field> fields_;
+	
+	// First value of element name, optionally only within aggregate agg
+	const std::string* get(const char *name, const char *agg = nullptr) const
+	{
+		for (auto const& f : fields_)
+		{
+			if (name_equals(f.name_, name) && (!agg || name_equals(f.agg_, agg)))
+				return &f.value_;
+		}
+		return nullptr;
+	}
+	
+	bool get_decimal(const char *name, decimal& d, const char *agg = nullptr) const
+	{
+		auto val = get(name, agg);
+		return val && decimal::parse(*val, d);
+	}
+	
+	// Seconds since the epoch in UTC of a date element, 0 if missing
+	int64_t get_time(const char *name) const
+	{
+		int64_t secs;
+		auto val = get(name);
+		if (!val || !parse_epoch(*val, secs))
+			return 0;
+		return secs;
+	}
+	
+	// UNIQUEIDTYPE:UNIQUEID of the security
+	std::string secid() const
+	{
+		auto type = get("UNIQUEIDTYPE", "SECID");
+		auto id = get("UNIQUEID", "SECID");
+		if (!id)
+			return std::string();
+		return (type ? *type : std::string()) + ':' + *id;
+	}
+};
+
+// Collects the outermost transaction aggregates, or others given by name,
+// as txn_records, together with the account and currency of their statement
+struct record_sink
+{
+	struct frame
+	{
+		const std::string* name_ = nullptr;
+		bool txn_ = false;
+	};
+	
+	std::vector<txn_record>& records_;
+	const std::set<std::string>& names_;
+	bool in_txn_ = false;
+	std::string acct_;
+	std::string curdef_;
+	
+	record_sink(std::vector<txn_record>& records, const std::set<std::string>& names = transaction_names()):
+		records_(records),
+		names_(names)
+	{
+	}
+	
+	void open(frame& f, frame*, const std::string& name, const ofx_cont*)
+	{
+		f.name_ = &name;
+		if (in_txn_)
+			return;
+		std::string lname = str_lower(name);
+		if (names_.count(lname))
+		{
+			f.txn_ = in_txn_ = true;
+			records_.emplace_back();
+			auto& rec = records_.back();
+			rec.type_ = lname;
+			rec.acct_ = acct_;
+			rec.curdef_ = curdef_;
+		}
+	}
+	
+	void close(frame& f, frame*, const ofx_cont*, const std::string&, const ofx_cont*)
+	{
+		if (f.txn_)
+			in_txn_ = false;
+	}
+	
+	void tag(frame& f, str_view element, ofx_cont::tag_fmt, str_view text)
+	{
+		if (in_txn_)
+			records_.back().fields_.push_back(txn_record::field{*f.name_, std::string(element), std::string(text)});
+		else if (name_equals(element, "ACCTID"))
+			acct_ = std::string(text);
+		else if (name_equals(element, "CURDEF"))
+			curdef_ = std::string(text);
+	}
+};
+
+// Journal of completed batch inputs.  Each line records the input path,
+// its size and mtime, a hash of its content and the output written for it.
+// Entries are buffered and committed in groups: the outputs are synced first,
+// then the journal lines are appended and synced, so that a committed entry
+// always refers to a durable output.  Entries that fail to commit stay
+// pending and are retried with the next group.
+struct batch_journal
+{
+	struct entry
+	{
+		off_t size_;
+		int64_t mtime_ns_;
+		std::string hash_;
+		std::string output_;
+	};
+	
+	static const size_t commit_entries = 1024;
+	static const int commit_interval_ms = 1000;
+	
+	int fd_;
+	int sync_fd_;
+	std::unordered_map<std::string, entry> done_;
+	std::unordered_map<std::string, std::string> outputs_; // input of each output
+	std::mutex mtx_;
+	std::string pending_;
+	size_t npending_;
+	std::chrono::steady_clock::time_point first_pending_;
+	
+	batch_journal():
+		fd_(-1),
+		sync_fd_(-1),
+		npending_(0)
+	{
+	}
+	
+	~batch_journal()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+		if (sync_fd_ >= 0)
+			close(sync_fd_);
+	}
+	
+	static int64_t mtime_ns(const struct stat& st)
+	{
+		return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	}
+	
+	// Inputs are recorded by absolute path, so that a batch can be resumed
+	// from another working directory
+	static std::string key(const std::string& input)
+	{
+		char *path = realpath(input.c_str(), nullptr);
+		if (!path)
+			return input;
+		std::string ret(path);
+		free(path);
+		return ret;
+	}
+	
+	bool open(const char *path, const char *output_dir)
+	{
+		std::ifstream fi(path);
+		std::string line;
+		while (std::getline(fi, line))
+		{
+			// a torn last line (no newline) is ignored
+			if (fi.eof())
+				break;
+			std::istringstream ls(line);
+			std::string input;
+			entry e;
+			if (std::getline(ls, input, '\t') && (ls >> e.size_ >> e.mtime_ns_ >> e.hash_) && ls.get() == '\t' && std::getline(ls, e.output_))
+			{
+				outputs_[e.output_] = input;
+				done_[input] = std::move(e);
+			}
+		}
+		
+		fd_ = ::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (fd_ < 0)
+		{
+			logErr("Cannot open journal " << path << ": " << strerror(errno));
+			return false;
+		}
+		sync_fd_ = ::open(output_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (sync_fd_ < 0)
+		{
+			logErr("Cannot open " << output_dir << ": " << strerror(errno));
+			return false;
+		}
+		return true;
+	}
+	
+	// The entry of input if it was completed with the same size and mtime
+	const entry* completed(const std::string& input, const struct stat& st) const
+	{
+		if (fd_ < 0)
+			return nullptr;
+		auto it = done_.find(key(input));
+		if (it == done_.end() || it->second.size_ != st.st_size || it->second.mtime_ns_ != mtime_ns(st))
+			return nullptr;
+		return &it->second;
+	}
+	
+	// An input rewritten within the same second keeps its size and mtime on
+	// file systems with whole second mtimes, so there only the content hash
+	// of a completed entry tells whether it is still the same input
+	static bool coarse_mtime(const struct stat& st)
+	{
+		return st.st_mtim.tv_nsec == 0;
+	}
+	
+	// Reserves output for input.  Inputs with the same base name in different
+	// directories would overwrite each other's output, so the first one wins
+	// and other is set to it for the others.
+	bool claim(const std::string& output, const std::string& input, std::string& other)
+	{
+		std::string k = key(input);
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = outputs_.emplace(output, k).first;
+		if (it->second == k)
+			return true;
+		other = it->second;
+		return false;
+	}
+	
+	void add(const std::string& input, const struct stat& st, const std::string& hash, const std::string& output)
+	{
+		if (fd_ < 0)
+			return;
+		std::string k = key(input);
+		if (k.find_first_of("\t\n") != std::string::npos || output.find('\n') != std::string::npos)
+			return;
+		std::ostringstream ls;
+		ls << k << '\t' << st.st_size << '\t' << mtime_ns(st) << '\t' << hash << '\t' << output << '\n';
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (npending_++ == 0)
+			first_pending_ = std::chrono::steady_clock::now();
+		pending_ += ls.str();
+		if (npending_ >= commit_entries || std::chrono::steady_clock::now() - first_pending_ >= std::chrono::milliseconds(commit_interval_ms))
+			commit_locked();
+	}
+	
+	// Returns false if entries are left uncommitted
+	bool commit()
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		return commit_locked();
+	}
+	
+	bool commit_locked()
+	{
+		if (fd_ < 0 || npending_ == 0)
+			return true;
+#ifdef HAVE_SYNCFS
+		if (syncfs(sync_fd_) != 0)
+		{
+			logErr("Syncing outputs failed: " << strerror(errno));
+			return retry_later();
+		}
+#else
+		sync();
+#endif
+		size_t off = 0;
+		while (off < pending_.size())
+		{
+			ssize_t n = write(fd_, pending_.data() + off, pending_.size() - off);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				logErr("Writing journal failed: " << strerror(errno));
+				// the lines written so far are completed by the retry
+				pending_.erase(0, off);
+				return retry_later();
+			}
+			off += n;
+		}
+		if (fdatasync(fd_) != 0)
+		{
+			// written again by the retry, a repeated line does no harm
+			logErr("Syncing journal failed: " << strerror(errno));
+			return retry_later();
+		}
+		pending_.clear();
+		npending_ = 0;
+		return true;
+	}
+	
+	bool retry_later()
+	{
+		first_pending_ = std::chrono::steady_clock::now();
+		return false;
+	}
+};
+
+struct worker_pool
+{
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> queue_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::condition_variable idle_cv_;
+	size_t busy_;
+	bool stop_;
+	
+	worker_pool(unsigned count):
+		busy_(0),
+		stop_(false)
+	{
+		if (count == 0)
+			count = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned i = 0; i < count; i++)
+			threads_.emplace_back([this]() { run(); });
+	}
+	
+	~worker_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		for (auto& t : threads_)
+			t.join();
+	}
+	
+	void post(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			queue_.push_back(std::move(job));
+		}
+		cv_.notify_one();
+	}
+	
+	// Wait until all posted jobs are finished
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		idle_cv_.wait(lock, [this]() { return queue_.empty() && busy_ == 0; });
+	}
+	
+	void run()
+	{
+		// signals are handled by the main thread
+		sigset_t set;
+		sigfillset(&set);
+		pthread_sigmask(SIG_BLOCK, &set, nullptr);
+		
+		std::unique_lock<std::mutex> lock(mtx_);
+		for (;;)
+		{
+			cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+			if (queue_.empty())
+				break;
+			auto job = std::move(queue_.front());
+			queue_.pop_front();
+			busy_++;
+			lock.unlock();
+			job();
+			lock.lock();
+			if (--busy_ == 0 && queue_.empty())
+				idle_cv_.notify_all();
+		}
+	}
+};
+
+// JSON text of a document in pieces: the members of the root object, the
+// elements of root members that are arrays, and the elements of large
+// arrays further down, such as the transactions of a statement, are
+// serialized into their own buffers on a worker pool.  The pieces are
+// written in order with writev, without joining them first.  Canonical
+// output is not split, as its fingerprints cover the whole document.
+struct json_pieces
+{
+	enum
+	{
+		parallel_min_size = 4 << 20, // input size worth splitting
+		split_min_elements = 256, // array size worth splitting
+		split_max_depth = 8 // levels below the root searched for such arrays
+	};
+	
+	struct piece
+	{
+		const rapidjson::Value* val_; // nullptr for literal text in buf_
+		size_t count_; // consecutive array elements starting at val_
+		rapidjson::StringBuffer buf_;
+		
+		piece(const rapidjson::Value* val, size_t count = 1):
+			val_(val),
+			count_(count)
+		{
+		}
+	};
+	
+	std::deque<piece> pieces_;
+	const std::unordered_set<const char*>& raw_numbers_;
+	
+	void literal(const char* text)
+	{
+		if (pieces_.empty() || pieces_.back().val_)
+			pieces_.emplace_back(nullptr);
+		auto& buf = pieces_.back().buf_;
+		for (; *text; text++)
+			buf.Put(*text);
+	}
+	
+	void key(const rapidjson::Value& name)
+	{
+		if (pieces_.empty() || pieces_.back().val_)
+			pieces_.emplace_back(nullptr);
+		rapidjson::Writer<rapidjson::StringBuffer> writer(pieces_.back().buf_);
+		writer.String(name.GetString(), name.GetStringLength());
+		pieces_.back().buf_.Put(':');
+	}
+	
+	// Whether val holds an array worth splitting within depth levels
+	static bool splittable(const rapidjson::Value& val, unsigned depth)
+	{
+		if (depth == 0)
+			return false;
+		if (val.IsArray())
+		{
+			if (val.Size() >= split_min_elements)
+				return true;
+			for (auto e = val.Begin(); e != val.End(); ++e)
+				if (splittable(*e, depth - 1))
+					return true;
+		}
+		else if (val.IsObject())
+		{
+			for (auto m = val.MemberBegin(); m != val.MemberEnd(); ++m)
+				if (splittable(m->value, depth - 1))
+					return true;
+		}
+		return false;
+	}
+	
+	// Adds val as one piece, or split down to its large arrays, whose
+	// elements become pieces of split_min_elements elements each.  An
+	// array is split anyway when split is set.
+	void add(const rapidjson::Value& val, unsigned depth, bool split)
+	{
+		if (val.IsArray() && val.Size() >= split_min_elements)
+		{
+			literal("[");
+			for (rapidjson::SizeType i = 0; i < val.Size(); i += split_min_elements)
+			{
+				if (i)
+					literal(",");
+				pieces_.emplace_back(val.Begin() + i, std::min<size_t>(split_min_elements, val.Size() - i));
+			}
+			literal("]");
+		}
+		else if (val.IsArray() && (split || splittable(val, depth)))
+		{
+			literal("[");
+			for (auto e = val.Begin(); e != val.End(); ++e)
+			{
+				if (e != val.Begin())
+					literal(",");
+				add(*e, depth - 1, false);
+			}
+			literal("]");
+		}
+		else if (val.IsObject() && splittable(val, depth))
+		{
+			literal("{");
+			for (auto m = val.MemberBegin(); m != val.MemberEnd(); ++m)
+			{
+				if (m != val.MemberBegin())
+					literal(",");
+				key(m->name);
+				add(m->value, depth - 1, false);
+			}
+			literal("}");
+		}
+		else
+			pieces_.emplace_back(&val);
+	}
+	
+	json_pieces(const ofx_document& doc):
+		raw_numbers_(doc.raw_numbers_)
+	{
+		literal("{");
+		for (auto m = doc.MemberBegin(); m != doc.MemberEnd(); ++m)
+		{
+			if (m != doc.MemberBegin())
+				literal(",");
+			key(m->name);
+			add(m->value, split_max_depth, true);
+		}
+		literal("}\n");
+	}
+	
+	void serialize(worker_pool& pool)
+	{
+		for (auto& p : pieces_)
+		{
+			if (!p.val_)
+				continue;
+			piece* pp = &p;
+			pool.post([this, pp]()
+			{
+				rapidjson::Writer<rapidjson::StringBuffer> writer(pp->buf_);
+				raw_number_writer<decltype(writer)> rwriter(writer, raw_numbers_);
+				for (size_t i = 0; i < pp->count_; i++)
+				{
+					if (i)
+					{
+						pp->buf_.Put(',');
+						writer.Reset(pp->buf_);
+					}
+					if (g_raw_numbers)
+						pp->val_[i].Accept(rwriter);
+					else
+						pp->val_[i].Accept(writer);
+				}
+			});
+		}
+		pool.wait();
+	}
+	
+	bool write(int fd)
+	{
+		std::vector<struct iovec> iov;
+		for (auto& p : pieces_)
+		{
+			if (p.buf_.GetSize())
+				iov.push_back(iovec{const_cast<char*>(p.buf_.GetString()), p.buf_.GetSize()});
+		}
+		size_t i = 0;
+		while (i < iov.size())
+		{
+			ssize_t n = writev(fd, &iov[i], std::min(iov.size() - i, (size_t)IOV_MAX));
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			while (i < iov.size() && (size_t)n >= iov[i].iov_len)
+				n -= iov[i++].iov_len;
+			if (n > 0)
+			{
+				iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+				iov[i].iov_len -= n;
+			}
+		}
+		return true;
+	}
+};
+
+static void read_input(const char *path, std::string& in)
+{
+	auto eit = std::istreambuf_iterator<char>();
+	if (path)
+	{
+		std::ifstream fi(path);
+		fi.exceptions(std::ifstream::failbit);
+		in.assign(std::istreambuf_iterator<char>(fi), eit);
+	}
+	else
+		in.assign(std::istreambuf_iterator<char>(std::cin), eit);
+}
+
+// Position of the <OFX> start tag, in any case
+static size_t find_ofx_start(const std::string& in)
+{
+	for (size_t pos = in.find('<'); pos != std::string::npos; pos = in.find('<', pos + 1))
+	{
+		if (pos + 5 <= in.size() && in[pos + 4] == '>' && name_equals(str_view(in.data() + pos + 1, 3), "OFX"))
+			return pos;
+	}
+	return std::string::npos;
+}
+
+// Position right after the <OFX> start tag
+static size_t ofx_body_start(const std::string& in)
+{
+	size_t pos = find_ofx_start(in);
+	if (pos == std::string::npos)
+		throw std::runtime_error("Not an OFX file");
+	return pos + 5;
+}
+
+static void write_json(const ofx_document& doc, rapidjson::StringBuffer& sbuf)
+{
+	rapidjson::Writer<rapidjson::StringBuffer> writer(sbuf);
+	if (g_canonical)
+	{
+		fingerprint_writer<decltype(writer)> fwriter(writer, transaction_names());
+		doc.Accept(fwriter);
+	}
+	else if (g_raw_numbers)
+	{
+		raw_number_writer<decltype(writer)> rwriter(writer, doc.raw_numbers_);
+		doc.Accept(rwriter);
+	}
+	else
+		doc.Accept(writer);
+}
+
+// Returns the document, or nullptr if processing failed
+static std::shared_ptr<ofx_document> parse_ofx(std::string& in)
+{
+	size_t pos = ofx_body_start(in);
+	auto doc = std::make_shared<ofx_document>();
+	dom_sink sink(doc);
+	if (!process_ofx(sink, in, pos))
+		return nullptr;
+	return doc;
+}
+
+// Like parse_ofx, but also feeds extra from the same parse
+template <typename Extra>
+static std::shared_ptr<ofx_document> parse_ofx(std::string& in, Extra& extra)
+{
+	size_t pos = ofx_body_start(in);
+	auto doc = std::make_shared<ofx_document>();
+	dom_sink dom(doc);
+	fanout_sink<dom_sink, Extra> sink(dom, extra);
+	if (!process_ofx(sink, in, pos))
+		return nullptr;
+	return doc;
+}
+
+static bool convert_ofx(std::string& in, rapidjson::StringBuffer& sbuf)
+{
+	auto doc = parse_ofx(in);
+	if (!doc)
+		return false;
+	write_json(*doc, sbuf);
+	return true;
+}
+
+// Flat record of the events of one parse: fixed size entries and a string
+// arena holding all names and values.  There are no pointers in it, so it
+// can be written to a file and mapped back to replay the events into any
+// sink without tokenizing the OFX again.
+struct tape_entry
+{
+	enum kind
+	{
+		open = 0,
+		close,
+		tag
+	};
+	
+	uint32_t name_; // offset in the arena
+	uint32_t value_; // offset in the arena, tags only
+	uint32_t value_len_;
+	uint16_t name_len_;
+	uint8_t kind_;
+	uint8_t fmt_; // ofx_cont::tag_fmt, tags only
+};
+
+struct tape_header
+{
+	char magic_[8];
+	uint32_t version_; // VERSION from the OFX header
+	uint32_t entry_size_;
+	uint64_t entries_;
+	uint64_t arena_size_;
+};
+
+static const char tape_magic[8] = { 'O', 'F', 'X', 'T', 'A', 'P', 'E', '1' };
+
+struct tape_sink
+{
+	struct frame {};
+	
+	uint32_t version_;
+	std::vector<tape_entry> entries_;
+	std::string arena_;
+	std::unordered_map<std::string, uint32_t> names_;
+	
+	tape_sink(uint32_t version):
+		version_(version)
+	{
+	}
+	
+	uint32_t append(str_view str)
+	{
+		if (arena_.size() + str.size() > UINT32_MAX)
+			throw std::runtime_error("Document too large for a tape");
+		uint32_t offset = arena_.size();
+		arena_.append(str.data(), str.size());
+		return offset;
+	}
+	
+	void add(tape_entry::kind kind, str_view name, ofx_cont::tag_fmt fmt, str_view value)
+	{
+		std::string key(name);
+		auto it = names_.find(key);
+		if (it == names_.end())
+			it = names_.emplace(key, append(name)).first;
+		tape_entry e;
+		e.name_ = it->second;
+		e.name_len_ = std::min(name.size(), (size_t)UINT16_MAX);
+		e.value_ = value.empty() ? 0 : append(value);
+		e.value_len_ = value.size();
+		e.kind_ = kind;
+		e.fmt_ = fmt;
+		entries_.push_back(e);
+	}
+	
+	void open(frame&, frame*, const std::string& name, const ofx_cont*)
+	{
+		add(tape_entry::open, name, ofx_cont::string, str_view());
+	}
+	
+	void close(frame&, frame*, const ofx_cont*, const std::string& name, const ofx_cont*)
+	{
+		add(tape_entry::close, name, ofx_cont::string, str_view());
+	}
+	
+	void tag(frame&, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		add(tape_entry::tag, element, fmt, text);
+	}
+	
+	void write(const char *path)
+	{
+		tape_header hdr;
+		memcpy(hdr.magic_, tape_magic, sizeof hdr.magic_);
+		hdr.version_ = version_;
+		hdr.entry_size_ = sizeof(tape_entry);
+		hdr.entries_ = entries_.size();
+		hdr.arena_size_ = arena_.size();
+		std::ofstream fo;
+		fo.exceptions(std::ifstream::failbit);
+		fo.open(path, std::ios::binary);
+		fo.write(reinterpret_cast<const char*>(&hdr), sizeof hdr);
+		fo.write(reinterpret_cast<const char*>(entries_.data()), entries_.size() * sizeof(tape_entry));
+		fo.write(arena_.data(), arena_.size());
+	}
+};
+
+// A tape file mapped into memory
+struct mapped_tape
+{
+	void *map_;
+	size_t size_;
+	const tape_header* hdr_;
+	const tape_entry* entries_;
+	const char* arena_;
+	
+	mapped_tape(const char *path):
+		map_(MAP_FAILED),
+		size_(0)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::ifstream::failure("open");
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(tape_header))
+		{
+			size_ = st.st_size;
+			map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (map_ == MAP_FAILED)
+			throw std::runtime_error("Not a tape file");
+		hdr_ = static_cast<const tape_header*>(map_);
+		entries_ = reinterpret_cast<const tape_entry*>(hdr_ + 1);
+		arena_ = reinterpret_cast<const char*>(entries_ + hdr_->entries_);
+		if (memcmp(hdr_->magic_, tape_magic, sizeof tape_magic) != 0 || hdr_->entry_size_ != sizeof(tape_entry) ||
+			hdr_->entries_ > (size_ - sizeof(tape_header)) / sizeof(tape_entry) ||
+			hdr_->arena_size_ != size_ - sizeof(tape_header) - hdr_->entries_ * sizeof(tape_entry))
+		{
+			munmap(map_, size_);
+			throw std::runtime_error("Not a tape file");
+		}
+	}
+	
+	~mapped_tape()
+	{
+		munmap(map_, size_);
+	}
+	
+	mapped_tape(const mapped_tape&) = delete;
+	mapped_tape& operator=(const mapped_tape&) = delete;
+};
+
+// Feeds the events recorded on a tape to sink, through the same containers
+// as process_ofx
+template <typename Sink>
+static bool replay_tape(const mapped_tape& tape, Sink& sink)
+{
+	process_ctx<Sink> pctx(sink);
+	for (uint64_t i = 0; i < tape.hdr_->entries_; i++)
+	{
+		const tape_entry& e = tape.entries_[i];
+		if ((uint64_t)e.name_ + e.name_len_ > tape.hdr_->arena_size_ ||
+			(uint64_t)e.value_ + e.value_len_ > tape.hdr_->arena_size_)
+		{
+			logErr("invalid tape entry " << i);
+			return false;
+		}
+		str_view name(tape.arena_ + e.name_, e.name_len_);
+		switch (e.kind_)
+		{
+			case tape_entry::open:
+				if (pctx.ostack_.empty())
+					pctx.push_container(new ofx_container<Sink>("OFX", schema_root(tape.hdr_->version_), pctx));
+				else
+				{
+					auto entry = pctx.ostack_.front()->index_->lookup(name, name_hash(name));
+					if (!entry || !entry->sub_)
+					{
+						logErr("unexpected aggregate on tape: " << name);
+						return false;
+					}
+					pctx.push_container(new ofx_container<Sink>(*entry->name_, entry->sub_, pctx));
+				}
+				break;
+			case tape_entry::close:
+				if (pctx.ostack_.empty())
+				{
+					logErr("unbalanced tape");
+					return false;
+				}
+				pctx.ostack_.front()->done();
+				pctx.ostack_.pop_front();
+				break;
+			case tape_entry::tag:
+				if (pctx.ostack_.empty() || e.fmt_ > ofx_cont::symbol)
+				{
+					logErr("invalid tape entry " << i);
+					return false;
+				}
+				pctx.sink_.tag(pctx.ostack_.front()->frame_, name, (ofx_cont::tag_fmt)e.fmt_, str_view(tape.arena_ + e.value_, e.value_len_));
+				break;
+			default:
+				logErr("invalid tape entry " << i);
+				return false;
+		}
+	}
+	if (!pctx.ostack_.empty())
+	{
+		logErr("unbalanced tape");
+		return false;
+	}
+	return true;
+}
+
+static std::shared_ptr<ofx_document> replay_ofx(const mapped_tape& tape)
+{
+	auto doc = std::make_shared<ofx_document>();
+	dom_sink sink(doc);
+	if (!replay_tape(tape, sink))
+		return nullptr;
+	return doc;
+}
+
+template <typename Extra>
+static std::shared_ptr<ofx_document> replay_ofx(const mapped_tape& tape, Extra& extra)
+{
+	auto doc = std::make_shared<ofx_document>();
+	dom_sink dom(doc);
+	fanout_sink<dom_sink, Extra> sink(dom, extra);
+	if (!replay_tape(tape, sink))
+		return nullptr;
+	return doc;
+}
+
+// The optional outputs besides JSON, fed from the same parse
+struct extra_sinks
+{
+	struct frame
+	{
+		csv_sink::frame csv_;
+		stats_sink::frame stats_;
+	};
+	
+	csv_sink* csv_ = nullptr;
+	stats_sink* stats_ = nullptr;
+	tape_sink* tape_ = nullptr;
+	
+	void open(frame& f, frame* parent, const std::string& name, const ofx_cont* cont)
+	{
+		tape_sink::frame tf;
+		if (csv_)
+			csv_->open(f.csv_, parent ? &parent->csv_ : nullptr, name, cont);
+		if (stats_)
+			stats_->open(f.stats_, parent ? &parent->stats_ : nullptr, name, cont);
+		if (tape_)
+			tape_->open(tf, nullptr, name, cont);
+	}
+	
+	void close(frame& f, frame* parent, const ofx_cont* parent_cont, const std::string& name, const ofx_cont* cont)
+	{
+		tape_sink::frame tf;
+		if (csv_)
+			csv_->close(f.csv_, parent ? &parent->csv_ : nullptr, parent_cont, name, cont);
+		if (stats_)
+			stats_->close(f.stats_, parent ? &parent->stats_ : nullptr, parent_cont, name, cont);
+		if (tape_)
+			tape_->close(tf, nullptr, parent_cont, name, cont);
+	}
+	
+	void tag(frame& f, str_view element, ofx_cont::tag_fmt fmt, str_view text)
+	{
+		tape_sink::frame tf;
+		if (csv_)
+			csv_->tag(f.csv_, element, fmt, text);
+		if (stats_)
+			stats_->tag(f.stats_, element, fmt, text);
+		if (tape_)
+			tape_->tag(tf, element, fmt, text);
+	}
+};
+
+static bool validate_ofx(std::string& in)
+{
+	size_t pos = ofx_body_start(in);
+	validate_sink sink;
+	if (!process_ofx(sink, in, pos))
+		return false;
+	if (sink.errors_)
+		logErr(sink.errors_ << " invalid values");
+	return sink.errors_ == 0;
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = write(fd, data, size);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static std::string batch_output_path(const std::string& input)
+{
+	size_t start = input.rfind('/');
+	start = (start == std::string::npos) ? 0 : start + 1;
+	size_t end = input.rfind('.');
+	if (end == std::string::npos || end <= start)
+		end = input.size();
+	return std::string(g_output_dir) + '/' + input.substr(start, end - start) + ".json";
+}
+
+// Whether both paths resolve to the same existing directory
+static bool same_dir(const char *a, const char *b)
+{
+	char *ra = realpath(a, nullptr);
+	char *rb = realpath(b, nullptr);
+	bool ret = ra && rb && strcmp(ra, rb) == 0;
+	free(ra);
+	free(rb);
+	return ret;
+}
+
+// done is the journal entry of input with the same size and mtime, if any,
+// which is only trusted if the content hash matches as well
+static bool convert_batch_data(const std::string& input, const struct stat& st, std::string& in, batch_journal& journal, const batch_journal::entry* done, std::string& error)
+{
+	std::string output = batch_output_path(input);
+	std::string other;
+	if (!journal.claim(output, input, other))
+	{
+		error = "output " + output + " is already written for " + other;
+		return false;
+	}
+	
+	// hash the input as read, before --zero-copy decodes it in place
+	fingerprint128 hash;
+	hash.update(in.data(), in.size());
+	if (done && done->hash_ == hash.hex())
+		return true;
+	
+	try
+	{
+		rapidjson::StringBuffer sbuf;
+		if (!convert_ofx(in, sbuf))
+		{
+			error = "processing failed";
+			return false;
+		}
+		
+		// write to a temporary file first, so that the output directory
+		// never contains partial output.  Its name is unique, as the same
+		// input may be converted again while a conversion is still running,
+		// and hidden, so that a spool directory watcher skips it.
+		size_t slash = output.rfind('/');
+		std::string tmp_output = output.substr(0, slash + 1) + '.' + output.substr(slash + 1) + ".XXXXXX";
+		int fd = mkstemp(&tmp_output[0]);
+		if (fd < 0)
+		{
+			error = std::string("cannot write ") + output + ": " + strerror(errno);
+			return false;
+		}
+		sbuf.Put('\n');
+		bool written = fchmod(fd, 0644) == 0 && write_all(fd, sbuf.GetString(), sbuf.GetSize());
+		if (close(fd) != 0)
+			written = false;
+		if (!written || rename(tmp_output.c_str(), output.c_str()) != 0)
+		{
+			error = std::string("cannot write ") + output + ": " + strerror(errno);
+			unlink(tmp_output.c_str());
+			return false;
+		}
+		
+		journal.add(input, st, hash.hex(), output);
+	}
+	catch (std::ifstream::failure& e)
+	{
+		error = "file operation failed";
+		return false;
+	}
+	catch (const std::runtime_error& e)
+	{
+		error = e.what();
+		return false;
+	}
+	return true;
+}
+
+static bool convert_batch_file(const std::string& input, batch_journal& journal, std::string& error)
+{
+	struct stat st;
+	if (stat(input.c_str(), &st) != 0)
+	{
+		error = strerror(errno);
+		return false;
+	}
+	const batch_journal::entry* done = journal.completed(input, st);
+	if (done && !batch_journal::coarse_mtime(st))
+		return true;
+	
+	std::string in;
+	try
+	{
+		read_input(input.c_str(), in);
+	}
+	catch (std::ifstream::failure& e)
+	{
+		error = "file operation failed";
+		return false;
+	}
+	return convert_batch_data(input, st, in, journal, done, error);
+}
+
+static void report_batch_error(const std::string& input, const std::string& error)
+{
+	logErr(input << ": " << error);
+	if (!g_error_dir)
+		return;
+	
+	size_t start = input.rfind('/');
+	start = (start == std::string::npos) ? 0 : start + 1;
+	std::ofstream fe(std::string(g_error_dir) + '/' + input.substr(start) + ".err");
+	fe << error << std::endl;
+}
+
+static void post_batch_file(worker_pool& pool, batch_journal& journal, std::atomic<bool>& failed, const std::string& input)
+{
+	pool.post([&journal, &failed, &input]()
+	{
+		std::string error;
+		if (!convert_batch_file(input, journal, error))
+		{
+			report_batch_error(input, error);
+			failed = true;
+		}
+	});
+}
+
+#ifdef HAVE_LIBURING
+// Reads the batch inputs through io_uring, keeping up to g_io_depth reads in
+// flight into registered, reused buffers.  Each completed read is handed to
+// the worker pool, which copies it out and releases the buffer before
+// converting.  Inputs larger than a buffer are read by the worker itself.
+// Registered buffers count against RLIMIT_MEMLOCK on older kernels, so the
+// depth is halved until they can be registered.  Returns false, after
+// saying so, if io_uring is not available, before any input was touched.
+static bool uring_batch(worker_pool& pool, batch_journal& journal, std::atomic<bool>& failed)
+{
+	static const size_t buf_size = 256 * 1024;
+	
+	struct slot
+	{
+		int fd_;
+		const std::string *input_;
+		struct stat st_;
+		const batch_journal::entry* done_;
+		size_t len_;
+		bool reading_;
+	};
+	
+	unsigned depth = g_io_depth;
+	struct io_uring ring;
+	int r = io_uring_queue_init(depth, &ring, 0);
+	if (r < 0)
+	{
+		logErr("Cannot set up io_uring: " << strerror(-r) << ", using plain reads");
+		return false;
+	}
+	
+	void *mem;
+	if (posix_memalign(&mem, 4096, depth * buf_size) != 0)
+	{
+		logErr("Cannot allocate io_uring buffers, using plain reads");
+		io_uring_queue_exit(&ring);
+		return false;
+	}
+	char *bufs = static_cast<char*>(mem);
+	std::vector<struct iovec> iovs(depth);
+	for (unsigned i = 0; i < depth; i++)
+	{
+		iovs[i].iov_base = bufs + i * buf_size;
+		iovs[i].iov_len = buf_size;
+	}
+	while ((r = io_uring_register_buffers(&ring, iovs.data(), depth)) == -ENOMEM && depth > 1)
+		depth /= 2;
+	if (r < 0)
+	{
+		logErr("Cannot register io_uring buffers: " << strerror(-r) << ", using plain reads");
+		io_uring_queue_exit(&ring);
+		free(mem);
+		return false;
+	}
+	
+	std::vector<slot> slots(depth);
+	std::vector<unsigned> free_slots;
+	for (unsigned i = depth; i > 0; i--)
+		free_slots.push_back(i - 1);
+	std::mutex mtx;
+	std::condition_variable cv;
+	
+	auto release = [&](unsigned i)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			free_slots.push_back(i);
+		}
+		cv.notify_one();
+	};
+	
+	unsigned inflight = 0;
+	auto submit_read = [&](unsigned i)
+	{
+		slot& sl = slots[i];
+		struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+		io_uring_prep_read_fixed(sqe, sl.fd_, bufs + i * buf_size + sl.len_, sl.st_.st_size - sl.len_, sl.len_, i);
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void*>((uintptr_t)i));
+		sl.reading_ = true;
+		inflight++;
+	};
+	
+	size_t next = 0;
+	bool aborted = false;
+	while (next < g_inputs.size() || inflight > 0)
+	{
+		while (next < g_inputs.size())
+		{
+			unsigned i;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (free_slots.empty())
+					break;
+				i = free_slots.back();
+				free_slots.pop_back();
+			}
+			
+			const std::string& input = g_inputs[next++];
+			slot& sl = slots[i];
+			sl.input_ = &input;
+			sl.len_ = 0;
+			sl.reading_ = false;
+			sl.fd_ = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+			if (sl.fd_ < 0)
+			{
+				report_batch_error(input, strerror(errno));
+				failed = true;
+				release(i);
+				continue;
+			}
+			if (fstat(sl.fd_, &sl.st_) != 0 || sl.st_.st_size == 0 || (size_t)sl.st_.st_size > buf_size)
+			{
+				// let the worker read (and report) it
+				close(sl.fd_);
+				release(i);
+				post_batch_file(pool, journal, failed, input);
+				continue;
+			}
+			sl.done_ = journal.completed(input, sl.st_);
+			if (sl.done_ && !batch_journal::coarse_mtime(sl.st_))
+			{
+				close(sl.fd_);
+				release(i);
+				continue;
+			}
+			submit_read(i);
+		}
+		
+		if (inflight == 0)
+		{
+			if (next >= g_inputs.size())
+				break;
+			// all buffers are held by workers
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&]() { return !free_slots.empty(); });
+			continue;
+		}
+		
+		r = io_uring_submit_and_wait(&ring, 1);
+		if (r < 0 && r != -EINTR)
+		{
+			logErr("io_uring submission failed: " << strerror(-r));
+			failed = true;
+			aborted = true;
+			break;
+		}
+		
+		struct io_uring_cqe *cqes[64];
+		unsigned n;
+		while ((n = io_uring_peek_batch_cqe(&ring, cqes, 64)) > 0)
+		{
+			for (unsigned c = 0; c < n; c++)
+			{
+				unsigned i = (unsigned)reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqes[c]));
+				int res = cqes[c]->res;
+				slot& sl = slots[i];
+				sl.reading_ = false;
+				inflight--;
+				if (res < 0)
+				{
+					close(sl.fd_);
+					report_batch_error(*sl.input_, strerror(-res));
+					failed = true;
+					release(i);
+					continue;
+				}
+				sl.len_ += res;
+				if (res > 0 && sl.len_ < (size_t)sl.st_.st_size)
+				{
+					submit_read(i); // short read
+					continue;
+				}
+				close(sl.fd_);
+				pool.post([&, i]()
+				{
+					const slot& sl = slots[i];
+					const std::string& input = *sl.input_;
+					struct stat st = sl.st_;
+					const batch_journal::entry* done = sl.done_;
+					std::string in(bufs + i * buf_size, sl.len_);
+					release(i);
+					std::string error;
+					if (!convert_batch_data(input, st, in, journal, done, error))
+					{
+						report_batch_error(input, error);
+						failed = true;
+					}
+				});
+			}
+			io_uring_cq_advance(&ring, n);
+		}
+	}
+	
+	// The reads that were submitted still complete into the buffers, so
+	// wait for them before the buffers are freed.  Those still queued in
+	// the submission ring never started.
+	bool drained = true;
+	if (aborted)
+	{
+		unsigned queued = io_uring_sq_ready(&ring);
+		while (inflight > queued)
+		{
+			struct io_uring_cqe *cqe;
+			r = io_uring_wait_cqe(&ring, &cqe);
+			if (r == -EINTR)
+				continue;
+			if (r < 0)
+			{
+				drained = false;
+				break;
+			}
+			unsigned i = (unsigned)reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+			io_uring_cqe_seen(&ring, cqe);
+			slots[i].reading_ = false;
+			close(slots[i].fd_);
+			report_batch_error(*slots[i].input_, "read aborted");
+			inflight--;
+		}
+		// if not drained, any of them may still be read into
+		for (auto& sl : slots)
+		{
+			if (drained && sl.reading_)
+			{
+				close(sl.fd_);
+				report_batch_error(*sl.input_, "read aborted");
+			}
+		}
+	}
+	
+	// workers may still be copying out of the buffers
+	pool.wait();
+	io_uring_unregister_buffers(&ring);
+	io_uring_queue_exit(&ring);
+	if (drained)
+		free(mem);
+	else
+		logErr("io_uring reads could not be waited for, leaking their buffers");
+	return true;
+}
+#endif
+
+static int run_batch()
+{
+	batch_journal journal;
+	if (g_journal && !journal.open(g_journal, g_output_dir))
+		return 1;
+	
+	// inputs that would overwrite the output of an earlier one are skipped
+	std::atomic<bool> failed(false);
+	std::vector<std::string> inputs;
+	for (auto const& input : g_inputs)
+	{
+		std::string other;
+		if (journal.claim(batch_output_path(input), input, other))
+			inputs.push_back(input);
+		else
+		{
+			report_batch_error(input, "output " + batch_output_path(input) + " is already written for " + other);
+			failed = true;
+		}
+	}
+	g_inputs.swap(inputs);
+	
+	{
+		worker_pool pool(g_jobs);
+#ifdef HAVE_LIBURING
+		if (g_io_depth > 0 && uring_batch(pool, journal, failed))
+			return journal.commit() && !failed ? 0 : 1;
+#endif
+		for (auto const& input : g_inputs)
+			post_batch_file(pool, journal, failed, input);
+		pool.wait();
+	}
+	return journal.commit() && !failed ? 0 : 1;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static volatile sig_atomic_t g_stop_watch = 0;
+
+// Files found by a scan that were modified more recently than this may
+// still be written to, and wait until they have settled
+static const int watch_settle_secs = 2;
+
+// Inputs of the spool directory being converted.  Events for an input
+// that is being converted are coalesced into one more conversion after it.
+struct watch_inputs
+{
+	std::mutex mtx_;
+	std::unordered_map<std::string, bool> running_; // converted again if true
+	std::set<std::string> unsettled_; // names waiting to settle
+	
+	// Returns false if input is being converted; it is converted again then
+	bool start(const std::string& input)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto r = running_.emplace(input, false);
+		if (!r.second)
+			r.first->second = true;
+		return r.second;
+	}
+	
+	// Returns true if input has to be converted again
+	bool finish(const std::string& input)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = running_.find(input);
+		if (it->second)
+		{
+			it->second = false;
+			return true;
+		}
+		running_.erase(it);
+		return false;
+	}
+};
+
+static void watch_convert(worker_pool& pool, batch_journal& journal, watch_inputs& inputs, const std::string& name)
+{
+	if (name[0] == '.')
+		return; // hidden or temporary file
+	inputs.unsettled_.erase(name);
+	std::string input = std::string(g_watch_dir) + '/' + name;
+	if (!inputs.start(input))
+		return;
+	pool.post([&journal, &inputs, input]()
+	{
+		do
+		{
+			std::string error;
+			if (!convert_batch_file(input, journal, error))
+				report_batch_error(input, error);
+		}
+		while (inputs.finish(input));
+	});
+}
+
+// Converts the unsettled files that have not been modified for a while,
+// and forgets those that are gone
+static void watch_settled(worker_pool& pool, batch_journal& journal, watch_inputs& inputs)
+{
+	time_t now = time(nullptr);
+	std::vector<std::string> settled;
+	for (auto it = inputs.unsettled_.begin(); it != inputs.unsettled_.end(); )
+	{
+		struct stat st;
+		std::string input = std::string(g_watch_dir) + '/' + *it;
+		if (stat(input.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			it = inputs.unsettled_.erase(it);
+		else if (now - st.st_mtime >= watch_settle_secs)
+		{
+			settled.push_back(*it);
+			it = inputs.unsettled_.erase(it);
+		}
+		else
+			++it;
+	}
+	for (auto const& name : settled)
+		watch_convert(pool, journal, inputs, name);
+}
+
+// Picks up the files of the spool directory, as there are no events for
+// those written while we were not watching
+static void watch_scan(worker_pool& pool, batch_journal& journal, watch_inputs& inputs)
+{
+	DIR *dir = opendir(g_watch_dir);
+	if (!dir)
+		return;
+	while (struct dirent *de = readdir(dir))
+	{
+		if (de->d_name[0] != '.' && (de->d_type == DT_REG || de->d_type == DT_UNKNOWN))
+			inputs.unsettled_.insert(de->d_name);
+	}
+	closedir(dir);
+	watch_settled(pool, journal, inputs);
+}
+
+// Converts files as soon as they are completely written to (or moved into)
+// the spool directory, until interrupted.
+static int run_watch()
+{
+	int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (fd < 0 || inotify_add_watch(fd, g_watch_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0)
+	{
+		logErr("Cannot watch " << g_watch_dir << ": " << strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = [](int) { g_stop_watch = 1; };
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+	
+	batch_journal journal;
+	if (g_journal && !journal.open(g_journal, g_output_dir))
+	{
+		close(fd);
+		return 1;
+	}
+	
+	int ret = 0;
+	{
+		watch_inputs inputs;
+		worker_pool pool(g_jobs);
+		
+		// pick up whatever arrived while we were not watching
+		watch_scan(pool, journal, inputs);
+		
+		alignas(struct inotify_event) char buf[64 * 1024];
+		while (!g_stop_watch)
+		{
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			int r = poll(&pfd, 1, batch_journal::commit_interval_ms);
+			if (!inputs.unsettled_.empty())
+				watch_settled(pool, journal, inputs);
+			if (r == 0)
+			{
+				journal.commit();
+				continue;
+			}
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				logErr("Watching " << g_watch_dir << " failed: " << strerror(errno));
+				ret = 1;
+				break;
+			}
+			
+			ssize_t len;
+			while ((len = read(fd, buf, sizeof buf)) > 0)
+			{
+				for (char *p = buf; p < buf + len; )
+				{
+					auto ev = reinterpret_cast<const struct inotify_event*>(p);
+					if (ev->mask & IN_Q_OVERFLOW)
+						watch_scan(pool, journal, inputs);
+					else if (ev->len > 0 && !(ev->mask & IN_ISDIR))
+						watch_convert(pool, journal, inputs, ev->name);
+					p += sizeof(struct inotify_event) + ev->len;
+				}
+			}
+		}
+		pool.wait();
+	}
+	if (!journal.commit())
+		ret = 1;
+	close(fd);
+	return ret;
+}
+#endif
+
+static void write_decimal(rapidjson::Writer<rapidjson::StringBuffer>& writer, decimal d)
+{
+	std::string str = d.str();
+	writer.RawValue(str.c_str(), str.size(), rapidjson::kNumberType);
+}
+
+// Replays buys, sells, reinvestments, transfers and splits in date order,
+// keeping the open lots per account and security.  Sales consume lots first
+// in first out, last in first out, or from one average cost pool, and each
+// sale is reported with the lots it consumed and its realized gain, or with
+// the units it sold beyond the open lots.
+struct lot_engine
+{
+	enum method
+	{
+		fifo = 0,
+		lifo,
+		average
+	};
+	
+	struct lot
+	{
+		int64_t acquired_;
+		std::string fitid_;
+		decimal units_;
+		decimal cost_;
+	};
+	
+	struct sale
+	{
+		const txn_record* rec_;
+		int64_t date_;
+		std::string secid_;
+		decimal units_;
+		decimal proceeds_;
+		decimal cost_;
+		decimal unmatched_; // units sold without an open lot
+		std::vector<lot> lots_;
+	};
+	
+	typedef std::pair<std::string, std::string> lot_key; // account, security
+	
+	method method_;
+	std::map<lot_key, std::deque<lot>> lots_;
+	std::vector<sale> sales_;
+	
+	lot_engine(method m):
+		method_(m)
+	{
+	}
+	
+	static method parse_method(const char *name, bool& ok)
+	{
+		ok = true;
+		if (!strcmp(name, "fifo"))
+			return fifo;
+		if (!strcmp(name, "lifo"))
+			return lifo;
+		if (!strcmp(name, "avg"))
+			return average;
+		ok = false;
+		return fifo;
+	}
+	
+	void add(const lot_key& key, const lot& l)
+	{
+		auto& q = lots_[key];
+		if (method_ == average && !q.empty())
+		{
+			q.front().units_ += l.units_;
+			q.front().cost_ += l.cost_;
+		}
+		else
+			q.push_back(l);
+	}
+	
+	// Takes units off the lots of key, returns the units that were not found
+	decimal take(const lot_key& key, decimal units, std::vector<lot>& taken)
+	{
+		auto it = lots_.find(key);
+		if (it == lots_.end())
+			return units;
+		auto& q = it->second;
+		while (units > decimal() && !q.empty())
+		{
+			lot& l = (method_ == lifo) ? q.back() : q.front();
+			if (l.units_ <= units)
+			{
+				units -= l.units_;
+				taken.push_back(l);
+				if (method_ == lifo)
+					q.pop_back();
+				else
+					q.pop_front();
+			}
+			else
+			{
+				decimal cost = decimal::mul_div(l.cost_, units, l.units_);
+				taken.push_back(lot{l.acquired_, l.fitid_, units, cost});
+				l.units_ -= units;
+				l.cost_ -= cost;
+				units = decimal();
+			}
+		}
+		if (q.empty())
+			lots_.erase(it);
+		return units;
+	}
+	
+	// Sum of the fee elements of a transaction
+	static decimal fees(const txn_record& rec)
+	{
+		decimal sum, d;
+		for (const char *name : { "COMMISSION", "FEES", "TAXES", "LOAD", "MARKDOWN", "MARKUP" })
+		{
+			if (rec.get_decimal(name, d))
+				sum += d;
+		}
+		return sum;
+	}
+	
+	void process(const txn_record& rec, int64_t date)
+	{
+		const std::string& type = rec.type_;
+		const std::string* fitid = rec.get("FITID");
+		lot_key key(rec.acct_, rec.secid());
+		decimal units, price, total;
+		bool has_units = rec.get_decimal("UNITS", units);
+		bool has_total = rec.get_decimal("TOTAL", total);
+		
+		if (type.compare(0, 3, "buy") == 0 || type == "reinvest")
+		{
+			if (!has_units || units.is_zero())
+				return;
+			decimal cost;
+			if (has_total)
+				cost = total.abs();
+			else if (rec.get_decimal("UNITPRICE", price))
+				cost = units.abs() * price + fees(rec);
+			add(key, lot{date, fitid ? *fitid : std::string(), units.abs(), cost});
+		}
+		else if (type.compare(0, 4, "sell") == 0)
+		{
+			if (!has_units || units.is_zero())
+				return;
+			sale s;
+			s.rec_ = &rec;
+			s.date_ = date;
+			s.secid_ = key.second;
+			s.units_ = units.abs();
+			if (has_total)
+				s.proceeds_ = total;
+			else if (rec.get_decimal("UNITPRICE", price))
+				s.proceeds_ = s.units_ * price - fees(rec);
+			s.unmatched_ = take(key, s.units_, s.lots_);
+			for (auto const& l : s.lots_)
+				s.cost_ += l.cost_;
+			sales_.push_back(std::move(s));
+		}
+		else if (type == "split")
+		{
+			decimal num, den;
+			if (!rec.get_decimal("NUMERATOR", num) || !rec.get_decimal("DENOMINATOR", den) || den.is_zero())
+			{
+				logErr("split " << (fitid ? *fitid : std::string()) << " without a valid ratio");
+				return;
+			}
+			auto it = lots_.find(key);
+			if (it != lots_.end())
+			{
+				// all or none of the lots are split if one overflows
+				std::vector<decimal> units;
+				for (auto const& l : it->second)
+					units.push_back(decimal::mul_div(l.units_, num, den));
+				for (size_t i = 0; i < units.size(); i++)
+					it->second[i].units_ = units[i];
+			}
+		}
+		else if (type == "transfer")
+		{
+			if (!has_units || units.is_zero())
+				return;
+			auto action = rec.get("TFERACTION");
+			if (action && name_equals(*action, "OUT"))
+			{
+				std::vector<lot> taken;
+				take(key, units.abs(), taken);
+			}
+			else
+			{
+				// AVGCOSTBASIS is the cost per unit of the transferred position
+				decimal basis;
+				rec.get_decimal("AVGCOSTBASIS", basis);
+				int64_t acquired = rec.get_time("DTPURCHASE");
+				add(key, lot{acquired ? acquired : date, fitid ? *fitid : std::string(), units.abs(), units.abs() * basis});
+			}
+		}
+	}
+	
+	static void write_lot(rapidjson::Writer<rapidjson::StringBuffer>& writer, const lot& l)
+	{
+		writer.Key("acquired");
+		writer.String(format_time(l.acquired_).c_str());
+		writer.Key("fitid");
+		writer.String(l.fitid_.c_str(), l.fitid_.size());
+		writer.Key("units");
+		write_decimal(writer, l.units_);
+		writer.Key("cost");
+		write_decimal(writer, l.cost_);
+	}
+	
+	void write(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+	{
+		static const char *method_names[] = { "fifo", "lifo", "avg" };
+		writer.Key("lots");
+		writer.StartObject();
+		writer.Key("method");
+		writer.String(method_names[method_]);
+		writer.Key("realized");
+		writer.StartArray();
+		for (auto const& s : sales_)
+		{
+			auto fitid = s.rec_->get("FITID");
+			writer.StartObject();
+			writer.Key("account");
+			writer.String(s.rec_->acct_.c_str(), s.rec_->acct_.size());
+			writer.Key("security");
+			writer.String(s.secid_.c_str(), s.secid_.size());
+			writer.Key("fitid");
+			writer.String(fitid ? fitid->c_str() : "");
+			writer.Key("date");
+			writer.String(format_time(s.date_).c_str());
+			writer.Key("units");
+			write_decimal(writer, s.units_);
+			writer.Key("proceeds");
+			write_decimal(writer, s.proceeds_);
+			writer.Key("cost");
+			write_decimal(writer, s.cost_);
+			// the cost of unmatched units is unknown, and so is the gain
+			if (s.unmatched_.is_zero())
+			{
+				writer.Key("gain");
+				write_decimal(writer, s.proceeds_ - s.cost_);
+			}
+			else
+			{
+				writer.Key("unmatched");
+				write_decimal(writer, s.unmatched_);
+			}
+			writer.Key("lots");
+			writer.StartArray();
+			for (auto const& l : s.lots_)
+			{
+				writer.StartObject();
+				write_lot(writer, l);
+				writer.EndObject();
+			}
+			writer.EndArray();
+			writer.EndObject();
+		}
+		writer.EndArray();
+		writer.Key("open");
+		writer.StartArray();
+		for (auto const& it : lots_)
+		{
+			for (auto const& l : it.second)
+			{
+				writer.StartObject();
+				writer.Key("account");
+				writer.String(it.first.first.c_str(), it.first.first.size());
+				writer.Key("security");
+				writer.String(it.first.second.c_str(), it.first.second.size());
+				write_lot(writer, l);
+				writer.EndObject();
+			}
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+};
+
+// Matches debits of one account against credits of the same absolute amount
+// and currency in another account, posted within a window of days.  Credits
+// are indexed by amount and currency in date order, so each debit only probes
+// the few credits of its bucket that fall within the window.
+struct transfer_matcher
+{
+	struct entry
+	{
+		const txn_record* rec_;
+		int64_t date_;
+		int32_t day_; // epoch_day of date_
+		decimal amount_;
+		std::string currency_;
+		bool matched_;
+	};
+	
+	struct key
+	{
+		decimal::int_type amount_;
+		std::string currency_;
+		
+		bool operator==(const key& other) const
+		{
+			return amount_ == other.amount_ && currency_ == other.currency_;
+		}
+	};
+	
+	struct key_hash
+	{
+		size_t operator()(const key& k) const
+		{
+			uint64_t lo = (uint64_t)k.amount_;
+			uint64_t hi = (uint64_t)(k.amount_ >> 64);
+			return std::hash<uint64_t>()(lo ^ (hi * 0x9e3779b97f4a7c15ull)) ^ std::hash<std::string>()(k.currency_);
+		}
+	};
+	
+	struct match
+	{
+		size_t debit_;
+		size_t credit_;
+		double confidence_;
+	};
+	
+	unsigned days_;
+	std::vector<entry> debits_;
+	std::vector<entry> credits_;
+	std::unordered_map<key, std::vector<size_t>, key_hash> index_;
+	std::vector<match> matches_;
+	
+	transfer_matcher(unsigned days):
+		days_(days)
+	{
+	}
+	
+	// The amount is in the CURRENCY of the transaction if given, otherwise
+	// in the CURDEF of the statement (also with ORIGCURRENCY)
+	static std::string currency(const txn_record& rec)
+	{
+		auto cursym = rec.get("CURSYM", "CURRENCY");
+		return cursym ? *cursym : rec.curdef_;
+	}
+	
+	// Transactions must be added in date order.  Those without a date
+	// cannot be matched and are left out.
+	void add(const txn_record& rec, int64_t date)
+	{
+		decimal amount;
+		if (!date || !rec.get_decimal("TRNAMT", amount) || amount.is_zero())
+			return;
+		entry e{&rec, date, epoch_day(date), amount, currency(rec), false};
+		if (amount.negative())
+			debits_.push_back(std::move(e));
+		else
+		{
+			index_[key{amount.v_, e.currency_}].push_back(credits_.size());
+			credits_.push_back(std::move(e));
+		}
+	}
+	
+	// Pairs each debit with the closest unmatched credit of another account
+	// within days_ calendar days.  Confidence falls with the distance in days
+	// and is shared between equally possible candidates.
+	void run()
+	{
+		for (size_t i = 0; i < debits_.size(); i++)
+		{
+			entry& d = debits_[i];
+			auto it = index_.find(key{d.amount_.abs().v_, d.currency_});
+			if (it == index_.end())
+				continue;
+			auto& bucket = it->second;
+			auto c = std::lower_bound(bucket.begin(), bucket.end(), (int64_t)d.day_ - days_,
+				[&](size_t idx, int64_t day) { return credits_[idx].day_ < day; });
+			size_t best = SIZE_MAX;
+			int64_t best_gap = 0;
+			unsigned candidates = 0;
+			for (; c != bucket.end() && credits_[*c].day_ <= (int64_t)d.day_ + days_; ++c)
+			{
+				const entry& e = credits_[*c];
+				if (e.matched_ || e.rec_->acct_ == d.rec_->acct_)
+					continue;
+				int64_t gap = std::abs((int64_t)e.day_ - d.day_);
+				candidates++;
+				if (best == SIZE_MAX || gap < best_gap)
+				{
+					best = *c;
+					best_gap = gap;
+				}
+			}
+			if (best == SIZE_MAX)
+				continue;
+			credits_[best].matched_ = d.matched_ = true;
+			double confidence = (1.0 - (double)best_gap / (days_ + 1)) / candidates;
+			matches_.push_back(match{i, best, confidence});
+		}
+	}
+	
+	static void write_entry(rapidjson::Writer<rapidjson::StringBuffer>& writer, const entry& e)
+	{
+		auto fitid = e.rec_->get("FITID");
+		writer.StartObject();
+		writer.Key("account");
+		writer.String(e.rec_->acct_.c_str(), e.rec_->acct_.size());
+		writer.Key("fitid");
+		writer.String(fitid ? fitid->c_str() : "");
+		writer.Key("date");
+		writer.String(format_time(e.date_).c_str());
+		writer.EndObject();
+	}
+	
+	void write(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+	{
+		writer.Key("transfers");
+		writer.StartObject();
+		writer.Key("days");
+		writer.Uint(days_);
+		writer.Key("matched");
+		writer.StartArray();
+		for (auto const& m : matches_)
+		{
+			const entry& d = debits_[m.debit_];
+			writer.StartObject();
+			writer.Key("amount");
+			write_decimal(writer, d.amount_.abs());
+			writer.Key("currency");
+			writer.String(d.currency_.c_str(), d.currency_.size());
+			writer.Key("confidence");
+			writer.Double(m.confidence_);
+			writer.Key("from");
+			write_entry(writer, d);
+			writer.Key("to");
+			write_entry(writer, credits_[m.credit_]);
+			writer.EndObject();
+		}
+		writer.EndArray();
+		writer.Key("unmatched_debits");
+		writer.Uint64(debits_.size() - matches_.size());
+		writer.Key("unmatched_credits");
+		writer.Uint64(credits_.size() - matches_.size());
+		writer.EndObject();
+	}
+};
+
+// Time series of the positions of each account and security over all
+// statements, by DTPRICEASOF.  Overlapping statements repeat the same
+// snapshot, which is kept once.
+struct position_series
+{
+	struct point
+	{
+		int64_t date_;
+		decimal units_;
+		decimal unitprice_;
+		decimal mktval_;
+		
+		bool operator==(const point& o) const
+		{
+			return date_ == o.date_ && units_ == o.units_ && unitprice_ == o.unitprice_ && mktval_ == o.mktval_;
+		}
+	};
+	
+	typedef std::pair<std::string, std::string> series_key; // account, security
+	
+	std::map<series_key, std::vector<point>> series_;
+	size_t undated_ = 0;
+	
+	void add(const txn_record& rec)
+	{
+		point p;
+		p.date_ = rec.get_time("DTPRICEASOF");
+		if (!p.date_)
+		{
+			undated_++;
+			return;
+		}
+		rec.get_decimal("UNITS", p.units_);
+		rec.get_decimal("UNITPRICE", p.unitprice_);
+		rec.get_decimal("MKTVAL", p.mktval_);
+		series_[series_key(rec.acct_, rec.secid())].push_back(p);
+	}
+	
+	// Sorts each series by date and drops repeated snapshots
+	void finish()
+	{
+		for (auto& it : series_)
+		{
+			auto& points = it.second;
+			std::stable_sort(points.begin(), points.end(),
+				[](const point& a, const point& b) { return a.date_ < b.date_; });
+			auto end = points.begin();
+			for (auto p = points.begin(); p != points.end(); ++p)
+			{
+				bool dup = false;
+				for (auto q = end; q != points.begin() && (q - 1)->date_ == p->date_ && !dup; --q)
+					dup = *(q - 1) == *p;
+				if (!dup)
+					*end++ = *p;
+			}
+			points.erase(end, points.end());
+		}
+	}
+	
+	// Columnar: one array per value, aligned with dates
+	void write(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+	{
+		writer.Key("positions");
+		writer.StartObject();
+		writer.Key("series");
+		writer.StartArray();
+		for (auto const& it : series_)
+		{
+			writer.StartObject();
+			writer.Key("account");
+			writer.String(it.first.first.c_str(), it.first.first.size());
+			writer.Key("security");
+			writer.String(it.first.second.c_str(), it.first.second.size());
+			writer.Key("dates");
+			writer.StartArray();
+			for (auto const& p : it.second)
+				writer.String(format_time(p.date_).c_str());
+			writer.EndArray();
+			writer.Key("units");
+			writer.StartArray();
+			for (auto const& p : it.second)
+				write_decimal(writer, p.units_);
+			writer.EndArray();
+			writer.Key("unitprice");
+			writer.StartArray();
+			for (auto const& p : it.second)
+				write_decimal(writer, p.unitprice_);
+			writer.EndArray();
+			writer.Key("mktval");
+			writer.StartArray();
+			for (auto const& p : it.second)
+				write_decimal(writer, p.mktval_);
+			writer.EndArray();
+			writer.EndObject();
+		}
+		writer.EndArray();
+		if (undated_)
+		{
+			writer.Key("undated");
+			writer.Uint64(undated_);
+		}
+		writer.EndObject();
+	}
+};
+
+// Finds recurring transactions: at least min_count ones of the same account
+// and payee, with a similar amount, at regular intervals.  Payees are
+// PAYEEID or the letters of NAME, so that reference numbers and dates in the
+// name do not split a series.  Transactions are added in date order, so the
+// dates of each group come sorted.
+struct recurring_detector
+{
+	struct key
+	{
+		std::string acct_;
+		std::string payee_;
+		bool credit_;
+		
+		bool operator<(const key& o) const
+		{
+			if (acct_ != o.acct_)
+				return acct_ < o.acct_;
+			if (payee_ != o.payee_)
+				return payee_ < o.payee_;
+			return credit_ < o.credit_;
+		}
+	};
+	
+	struct group
+	{
+		std::string acct_;
+		std::string payee_;
+		std::vector<int32_t> days_;
+		std::vector<decimal> amounts_;
+	};
+	
+	struct series
+	{
+		const group* group_;
+		const char* period_;
+		int32_t interval_;
+		unsigned months_; // calendar months per interval, 0 if counted in days
+		double regularity_;
+		decimal amount_;
+		int32_t next_;
+	};
+	
+	static const size_t min_count = 3;
+	
+	std::map<key, group> groups_;
+	std::vector<series> series_;
+	
+	// Letters of name in upper case, other runs of characters as a space
+	static std::string normalize(str_view name)
+	{
+		std::string ret;
+		bool space = false;
+		for (char c : name)
+		{
+			c = fold_upper(c);
+			if (c >= 'A' && c <= 'Z')
+			{
+				if (space && !ret.empty())
+					ret += ' ';
+				ret += c;
+				space = false;
+			}
+			else
+				space = true;
+		}
+		return ret;
+	}
+	
+	void add(const txn_record& rec, int64_t date)
+	{
+		decimal amount;
+		if (!date || !rec.get_decimal("TRNAMT", amount) || amount.is_zero())
+			return;
+		std::string payee;
+		auto payeeid = rec.get("PAYEEID");
+		if (payeeid)
+			payee = *payeeid;
+		else if (auto name = rec.get("NAME"))
+			payee = normalize(*name);
+		if (payee.empty())
+			return;
+		
+		group& g = groups_[key{rec.acct_, payee, !amount.negative()}];
+		if (g.days_.empty())
+		{
+			g.acct_ = rec.acct_;
+			g.payee_ = payee;
+		}
+		g.days_.push_back(epoch_day(date));
+		g.amounts_.push_back(amount);
+	}
+	
+	template <typename T>
+	static T median(std::vector<T> v)
+	{
+		std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+		return v[v.size() / 2];
+	}
+	
+	// The share of intervals within a tolerance of the median interval must
+	// be at least 3/4, and so must the share of amounts within 10% of the
+	// median amount
+	void run()
+	{
+		static const struct
+		{
+			const char* name_;
+			int32_t min_, max_;
+			unsigned months_;
+		} periods[] = {
+			{ "weekly", 6, 8, 0 },
+			{ "biweekly", 13, 15, 0 },
+			{ "monthly", 27, 32, 1 },
+			{ "quarterly", 88, 94, 3 },
+			{ "yearly", 358, 372, 12 },
+		};
+		
+		for (auto const& it : groups_)
+		{
+			const group& g = it.second;
+			if (g.days_.size() < min_count)
+				continue;
+			std::vector<int32_t> intervals;
+			for (size_t i = 1; i < g.days_.size(); i++)
+			{
+				if (g.days_[i] != g.days_[i - 1])
+					intervals.push_back(g.days_[i] - g.days_[i - 1]);
+			}
+			if (intervals.size() + 1 < min_count)
+				continue;
+			
+			series s{&g, nullptr, median(intervals), 0, 0, median(g.amounts_), 0};
+			int32_t tolerance = std::max<int32_t>(2, s.interval_ / 10);
+			unsigned regular = 0;
+			for (int32_t d : intervals)
+			{
+				if (std::abs(d - s.interval_) <= tolerance)
+					regular++;
+			}
+			decimal spread = decimal::raw(decimal::div_round(s.amount_.abs().v_, 10));
+			unsigned similar = 0;
+			for (auto const& a : g.amounts_)
+			{
+				if ((a - s.amount_).abs() <= spread)
+					similar++;
+			}
+			if (regular * 4 < intervals.size() * 3 || similar * 4 < g.amounts_.size() * 3)
+				continue;
+			
+			s.regularity_ = (double)regular / intervals.size();
+			for (auto const& p : periods)
+			{
+				if (s.interval_ >= p.min_ && s.interval_ <= p.max_)
+				{
+					s.period_ = p.name_;
+					s.months_ = p.months_;
+				}
+			}
+			int32_t last = g.days_.back();
+			if (s.months_)
+			{
+				int64_t y;
+				unsigned m, d;
+				civil_from_days(last, y, m, d);
+				unsigned months = (unsigned)(y * 12 + m - 1) + s.months_;
+				y = months / 12;
+				m = months % 12 + 1;
+				static const unsigned mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+				unsigned dmax = mdays[m - 1] + (m == 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+				s.next_ = (int32_t)days_from_civil(y, m, std::min(d, dmax));
+			}
+			else
+				s.next_ = last + s.interval_;
+			series_.push_back(s);
+		}
+		std::sort(series_.begin(), series_.end(), [](const series& a, const series& b)
+		{
+			if (a.group_->acct_ != b.group_->acct_)
+				return a.group_->acct_ < b.group_->acct_;
+			if (a.group_->payee_ != b.group_->payee_)
+				return a.group_->payee_ < b.group_->payee_;
+			return a.amount_ < b.amount_;
+		});
 	}
-};
-
-static const ofx_cont ofx_mfassetclass_portion = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "ASSETCLASS", ofx_cont::string },
-		{ "PERCENT", ofx_cont::number },
+	
+	void write(rapidjson::Writer<rapidjson::StringBuffer>& writer)
+	{
+		writer.Key("recurring");
+		writer.StartArray();
+		for (auto const& s : series_)
+		{
+			const group& g = *s.group_;
+			writer.StartObject();
+			writer.Key("account");
+			writer.String(g.acct_.c_str(), g.acct_.size());
+			writer.Key("payee");
+			writer.String(g.payee_.c_str(), g.payee_.size());
+			writer.Key("count");
+			writer.Uint64(g.days_.size());
+			if (s.period_)
+			{
+				writer.Key("period");
+				writer.String(s.period_);
+			}
+			writer.Key("interval");
+			writer.Int(s.interval_);
+			writer.Key("regularity");
+			writer.Double(s.regularity_);
+			writer.Key("amount");
+			write_decimal(writer, s.amount_);
+			writer.Key("first");
+			writer.String(format_time((int64_t)g.days_.front() * 86400).c_str());
+			writer.Key("last");
+			writer.String(format_time((int64_t)g.days_.back() * 86400).c_str());
+			writer.Key("next");
+			writer.String(format_time((int64_t)s.next_ * 86400).c_str());
+			writer.EndObject();
+		}
+		writer.EndArray();
 	}
 };
 
-static const ofx_cont ofx_mfassetclass = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "PORTION", &ofx_mfassetclass_portion },
-	},
-	tags: {}
-};
-
-static const ofx_cont ofx_fimfassetclass_portion = {
-	serialize: ofx_cont::object,
-	sub: {},
-	tags: {
-		{ "FIASSETCLASS", ofx_cont::string },
-		{ "PERCENT", ofx_cont::number },
-	}
-};
+// The analysis modes read all inputs, collect their transactions in date
+// order and write a report instead of the converted documents
+static bool analysis_mode()
+{
+	return g_lots || g_transfer_days >= 0 || g_positions || g_recurring;
+}
 
-static const ofx_cont ofx_fimfassetclass = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "FIPORTION", &ofx_fimfassetclass_portion },
-	},
-	tags: {}
+// Transactions and positions of one input
+struct analysis_input
+{
+	std::vector<txn_record> txns_;
+	std::vector<txn_record> positions_;
+	bool ok_ = false;
 };
 
-static const ofx_cont ofx_seclistmsgsrsv1_seclist_mfinfo = {
-	serialize: ofx_cont::object,
-	sub: {
-		{ "SECINFO", &ofx_secinfo },
-		{ "MFASSETCLASS", &ofx_mfassetclass },
-		{ "FIMFASSETCLASS", &ofx_fimfassetclass },
-	},
-	tags: {
-		{ "MFTYPE", ofx_cont::string },
-		{ "YIELD", ofx_cont::number },
-		{ "DTYIELDASOF", ofx_cont::datetime },
+static void load_analysis_input(const std::string& input, analysis_input& result)
+{
+	try
+	{
+		record_sink txns(result.txns_);
+		record_sink positions(result.positions_, position_names());
+		fanout_sink<record_sink, record_sink> sink(txns, positions);
+		if (g_from_tape)
+		{
+			mapped_tape tape(input.c_str());
+			result.ok_ = replay_tape(tape, sink);
+		}
+		else
+		{
+			std::string in;
+			read_input(input != "-" ? input.c_str() : nullptr, in);
+			size_t pos = ofx_body_start(in);
+			result.ok_ = process_ofx(sink, in, pos);
+		}
+		if (!result.ok_)
+			logErr(input << ": processing failed");
 	}
-};
-
-static const ofx_cont ofx_seclistmsgsrsv1_seclist = {
-	serialize: ofx_cont::object_with_name_in_array,
-	sub: {
-		{ "DEBTINFO", &ofx_seclistmsgsrsv1_seclist_debtinfo },
-		{ "MFINFO", &ofx_seclistmsgsrsv1_seclist_mfinfo },
-	//	{ "OPTINFO", &ofx_seclistmsgsrsv1_seclist_optinfo },
-	//	{ "OTHERINFO", &ofx_seclistmsgsrsv1_seclist_otherinfo },
-	//	{ "STOCKINFO", &ofx_seclistmsgsrsv1_seclist_stockinfo },
-	},
-	tags: {}
-};
-
-static const ofx_cont ofx_seclistmsgsrsv1 = {
-	serialize: ofx_cont::array,
-	sub: {
-		{ "SECLIST", &ofx_seclistmsgsrsv1_seclist },
-	},
-	tags: {}
-};
-
-static const ofx_cont ofx_main = {
-	serialize: ofx_cont::nothing,
-	sub: {
-		{ "SIGNONMSGSRSV1", &ofx_signonmsgsrsv1 },
-		{ "SIGNUPMSGSRSV1", &ofx_signupmsgsrsv1 },
-		{ "INVSTMTMSGSRSV1", &ofx_invstmtmsgsrsv1 },
-		{ "SECLISTMSGSRSV1", &ofx_seclistmsgsrsv1 },
-	},
-	tags: {}
-};
+	catch (std::ifstream::failure& e)
+	{
+		logErr(input << ": file operation failed");
+	}
+	catch (const std::runtime_error& e)
+	{
+		logErr(input << ": " << e.what());
+	}
+}
 
-static bool process_ofx(const std::shared_ptr<rapidjson::Document>& doc, const std::string& in, size_t& pos)
+static int run_analysis()
 {
-	process_ctx pctx(doc);
+	int ret = 0;
 	
-	pctx.push_container(new ofx_container("OFX", &ofx_main, pctx));
+	// inputs are parsed in parallel, their records are merged in order
+	std::vector<analysis_input> inputs(g_inputs.size());
+	{
+		worker_pool pool(std::min<size_t>(g_jobs ? g_jobs : std::max(1u, std::thread::hardware_concurrency()), g_inputs.size()));
+		for (size_t i = 0; i < g_inputs.size(); i++)
+			pool.post([&inputs, i]() { load_analysis_input(g_inputs[i], inputs[i]); });
+		pool.wait();
+	}
+	
+	// transactions without a date keep their place at the start
+	std::vector<std::pair<int64_t, const txn_record*>> order;
+	for (auto const& input : inputs)
+	{
+		if (!input.ok_)
+			ret = 1;
+		for (auto const& rec : input.txns_)
+		{
+			int64_t date = rec.get_time("DTTRADE");
+			if (!date)
+				date = rec.get_time("DTPOSTED");
+			order.push_back(std::make_pair(date, &rec));
+		}
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[](const std::pair<int64_t, const txn_record*>& a, const std::pair<int64_t, const txn_record*>& b) { return a.first < b.first; });
 	
-	if (!iterate_elements(in, pos,
-		[&](const std::string& element, const std::map<std::string, std::string>& attrs, const std::string& text) -> bool
+	rapidjson::StringBuffer sbuf;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(sbuf);
+	writer.StartObject();
+	if (g_lots)
+	{
+		bool ok;
+		lot_engine lots(lot_engine::parse_method(g_lots, ok));
+		for (auto const& o : order)
 		{
-			if (element[0] != '/')
+			try
 			{
-				assert(!pctx.ostack_.empty());
-				auto& os_top = *pctx.ostack_.front();
-				return os_top.handle_tag(element, attrs, text);
+				lots.process(*o.second, o.first);
 			}
-			else
+			catch (const std::overflow_error& e)
 			{
-				if (!pctx.ostack_.empty())
-				{
-					auto& os_top = *pctx.ostack_.front();
-					bool container_done = false;
-					if (!os_top.handle_close(element.substr(1), container_done))
-					{
-						logErr("mismatch for " << element << ", expecting /" << os_top.name_);
-						return false;
-					}
-					
-					if (container_done)
-					{
-						os_top.done();
-						pctx.ostack_.pop_front();
-					}
-				}
-				else
-				{
-					logErr("unexpected tag found: <" << element << '>');
-					return false;
-				}
+				auto fitid = o.second->get("FITID");
+				logErr("transaction " << (fitid ? *fitid : std::string()) << " skipped: " << e.what());
+				ret = 1;
 			}
-			
-			
-			return true;
-		}))
+		}
+		lots.write(writer);
+	}
+	if (g_transfer_days >= 0)
 	{
-		logErr("Processing failed.");
-		return true;
+		transfer_matcher transfers(g_transfer_days);
+		for (auto const& o : order)
+			transfers.add(*o.second, o.first);
+		transfers.run();
+		transfers.write(writer);
 	}
-	
-	if (pctx.ostack_.size() == 1)
+	if (g_positions)
 	{
-		auto& os_top = *pctx.ostack_.front();
-		bool container_done = false;
-		os_top.handle_close(os_top.name_, container_done);
-		pctx.ostack_.pop_front();
-		
-		if (!container_done)
-			return false;
+		position_series positions;
+		for (auto const& input : inputs)
+		{
+			for (auto const& rec : input.positions_)
+				positions.add(rec);
+		}
+		positions.finish();
+		positions.write(writer);
 	}
-	
-	if (!pctx.ostack_.empty())
+	if (g_recurring)
 	{
-		logErr("Stack not empty!");
-		return false;
+		recurring_detector recurring;
+		for (auto const& o : order)
+			recurring.add(*o.second, o.first);
+		recurring.run();
+		recurring.write(writer);
 	}
+	writer.EndObject();
 	
-	logDbg("Processing succeeded.");
-	return true;
+	try
+	{
+		std::ofstream fo;
+		if (g_output)
+		{
+			fo.exceptions(std::ifstream::failbit);
+			fo.open(g_output);
+		}
+		std::ostream& out = g_output ? fo : std::cout;
+		out << sbuf.GetString() << std::endl;
+	}
+	catch (std::ifstream::failure& e)
+	{
+		logErr("File operation failed");
+		ret = 1;
+	}
+	return ret;
 }
 
 int main(int argc, char *argv[])
@@ -1622,7 +6224,31 @@ int main(int argc, char *argv[])
 	{
 		{ nullptr, 0, nullptr, 0, "The following options are available:", -1 },
 		{ "output", 'o', "OUTPUT", 0, "Write json output to file OUTPUT", -1 },
+		{ "output-dir", 'd', "DIR", 0, "Convert all OFXFILEs, writing json output to DIR", -1 },
+		{ "journal", 'j', "JOURNAL", 0, "Record completed inputs in JOURNAL and skip them when restarting a batch", -1 },
+		{ "watch", 'w', "DIR", 0, "Convert files as they arrive in spool directory DIR (requires --output-dir)", -1 },
+		{ "error-dir", 'e', "DIR", 0, "Write errors of failed batch inputs to DIR", -1 },
+		{ "jobs", 'J', "N", 0, "Convert N batch inputs, or serialize parts of a large document, in parallel (default: number of CPUs)", -1 },
+		{ "io-depth", 'Q', "N", 0, "Keep up to N batch input reads in flight using io_uring, 0 to use plain reads (default: 64)", -1 },
 		{ "quiet", 'q', nullptr, 0, "Do not output errors", -1 },
+		{ "canonical", 'c', nullptr, 0, "Write canonical output (sorted members, exact numbers, UTC dates) with a trailing fingerprint member in each transaction and the document", -1 },
+		{ "raw-numbers", 'r', nullptr, 0, "Write numbers exactly as found in the input if they are valid JSON numbers", -1 },
+		{ "utc", 'u', nullptr, 0, "Convert all dates to UTC", -1 },
+		{ "utc-offsets", 'U', nullptr, 0, "Convert all dates to UTC and write their original offset as NAMEtzoff", -1 },
+		{ "zero-copy", 'z', nullptr, 0, "Reference string values in the input instead of copying them", -1 },
+		{ "running-balance", 'B', nullptr, 0, "Add the balance after each bank and credit card transaction as RUNNINGBAL, from LEDGERBAL", -1 },
+		{ "validate", 'V', nullptr, 0, "Only check that all values in OFXFILE parse, without writing output", -1 },
+		{ "csv", 'C', "CSVFILE", 0, "Also write the transactions to CSVFILE, from the same parse", -1 },
+		{ "stats", 'S', "STATSFILE", 0, "Also write element and transaction counts to STATSFILE, from the same parse", -1 },
+		{ "tape", 'T', "TAPEFILE", 0, "Also write the parsed events to TAPEFILE for use with --from-tape", -1 },
+		{ "from-tape", 'F', nullptr, 0, "Read the events from tape files given in place of OFXFILE instead of parsing OFX", -1 },
+		{ "lots", 'L', "METHOD", 0, "Report realized gains and open lots of all OFXFILEs, matching sales to lots by METHOD (fifo, lifo or avg)", -1 },
+		{ "positions", 'P', nullptr, 0, "Report the positions of all OFXFILEs as a time series per account and security", -1 },
+		{ "recurring", 'Y', nullptr, 0, "Report recurring transactions of all OFXFILEs with their period and next expected date", -1 },
+		{ "rules", 'R', "RULESFILE", 0, "Add the CATEGORY of the first matching rule in RULESFILE to each STMTTRN", -1 },
+		{ "base-currency", 'b', "CUR", 0, "Add BASEAMT, the amount of each transaction in currency CUR, using CURRATE or --rates", -1 },
+		{ "rates", 'x', "RATESFILE", 0, "Read daily rates into the base currency from RATESFILE, as lines of DATE,CURRENCY,RATE", -1 },
+		{ "transfers", 'X', "DAYS", 0, "Report transfers between the accounts of all OFXFILEs, matching debits to credits of the same amount within DAYS", -1 },
 		{ nullptr, 0, nullptr, 0, nullptr, 0 }
 	};
 	static const argp popts =
@@ -1633,62 +6259,287 @@ int main(int argc, char *argv[])
 			switch (key)
 			{
 				case ARGP_KEY_ARG:
-				{
-					if (state->arg_num == 0)
-					{
-						if (strcmp(arg, "-"))
-							g_input = strdup(arg);
-					}
-					else
-						argp_usage(state); /* too many arguments */
+					g_inputs.push_back(arg);
 					break;
-				}
 				case 'o':
 					if (arg[0])
 						g_output = strdup(arg);
 					break;
+				case 'd':
+					if (arg[0])
+						g_output_dir = strdup(arg);
+					break;
+				case 'j':
+					if (arg[0])
+						g_journal = strdup(arg);
+					break;
+				case 'w':
+					if (arg[0])
+						g_watch_dir = strdup(arg);
+					break;
+				case 'e':
+					if (arg[0])
+						g_error_dir = strdup(arg);
+					break;
+				case 'J':
+					g_jobs = strtoul(arg, nullptr, 10);
+					break;
+				case 'Q':
+					g_io_depth = std::min(strtoul(arg, nullptr, 10), 4096ul);
+#ifndef HAVE_LIBURING
+					if (g_io_depth > 0)
+						argp_error(state, "--io-depth requires io_uring support, which was not built in");
+#endif
+					break;
 				case 'q':
 					g_quiet = true;
 					break;
+				case 'c':
+					g_canonical = true;
+					break;
+				case 'r':
+					g_raw_numbers = true;
+					break;
+				case 'z':
+					g_zero_copy = true;
+					break;
+				case 'P':
+					g_positions = true;
+					break;
+				case 'Y':
+					g_recurring = true;
+					break;
+				case 'R':
+					if (arg[0])
+						g_rules = strdup(arg);
+					break;
+				case 'b':
+					if (arg[0])
+						g_base_currency = strdup(arg);
+					break;
+				case 'x':
+					if (arg[0])
+						g_rates = strdup(arg);
+					break;
+				case 'B':
+					g_running_balance = true;
+					break;
+				case 'V':
+					g_validate = true;
+					break;
+				case 'C':
+					if (arg[0])
+						g_csv = strdup(arg);
+					break;
+				case 'S':
+					if (arg[0])
+						g_stats = strdup(arg);
+					break;
+				case 'T':
+					if (arg[0])
+						g_tape = strdup(arg);
+					break;
+				case 'F':
+					g_from_tape = true;
+					break;
+				case 'L':
+				{
+					bool ok;
+					lot_engine::parse_method(arg, ok);
+					if (!ok)
+						argp_error(state, "unknown lot matching method '%s'", arg);
+					g_lots = strdup(arg);
+					break;
+				}
+				case 'X':
+				{
+					char *end;
+					unsigned long days = strtoul(arg, &end, 10);
+					if (!arg[0] || *end || days > 366)
+						argp_error(state, "invalid number of days '%s'", arg);
+					g_transfer_days = (int)days;
+					break;
+				}
+				case 'U':
+					g_utc_offsets = true;
+					// fall through
+				case 'u':
+					g_utc = true;
+					break;
 				case ARGP_KEY_END:
+					if (g_canonical && g_raw_numbers)
+						argp_error(state, "--canonical and --raw-numbers are mutually exclusive");
+					else if (g_output_dir && g_output)
+						argp_error(state, "--output and --output-dir are mutually exclusive");
+					else if (!g_output_dir && !analysis_mode() && g_inputs.size() > 1)
+						argp_usage(state); /* too many arguments */
+					else if (analysis_mode() && (g_output_dir || g_validate || g_csv || g_stats || g_tape || g_running_balance || g_rules || g_base_currency))
+						argp_error(state, "--lots, --transfers, --positions and --recurring write a report and cannot be combined with other outputs");
+					else if (g_rates && !g_base_currency)
+						argp_error(state, "--rates requires --base-currency");
+					else if (g_journal && !g_output_dir)
+						argp_error(state, "--journal requires --output-dir");
+					else if (g_watch_dir && !g_output_dir)
+						argp_error(state, "--watch requires --output-dir");
+					else if (g_watch_dir && !g_inputs.empty())
+						argp_usage(state); /* too many arguments */
+					else if (g_watch_dir && (same_dir(g_watch_dir, g_output_dir) || (g_error_dir && same_dir(g_watch_dir, g_error_dir))))
+						argp_error(state, "--output-dir and --error-dir must not be the --watch directory");
+					else if (g_validate && (g_output || g_output_dir || g_csv || g_stats || g_tape || g_from_tape))
+						argp_error(state, "--validate does not write output");
+					else if (g_output_dir && (g_csv || g_stats || g_tape || g_from_tape))
+						argp_error(state, "--csv, --stats, --tape and --from-tape cannot be used with --output-dir");
+					else if (g_from_tape && (g_inputs.empty() || std::find(g_inputs.begin(), g_inputs.end(), "-") != g_inputs.end()))
+						argp_error(state, "--from-tape requires a tape file");
 					break;
 				case ARGP_KEY_NO_ARGS:
-					argp_usage(state);
+					if (!g_watch_dir)
+						argp_usage(state);
 					break;
 				default:
 					return ARGP_ERR_UNKNOWN;
 			}
 			return 0;
 		},
-		"[OFXFILE]",
+		"[OFXFILE...]",
 		nullptr, nullptr, nullptr, nullptr
 	};
 	argp_parse(&popts, argc, argv, ARGP_IN_ORDER, nullptr, nullptr);
+	if (g_rules)
+	{
+		try
+		{
+			g_category_rules.reset(new category_rules(g_rules));
+		}
+		catch (const std::runtime_error& e)
+		{
+			logErr(g_rules << ": " << e.what());
+			free(g_rules);
+			return 1;
+		}
+		free(g_rules);
+	}
+	if (g_rates)
+	{
+		try
+		{
+			g_rate_table.reset(new rate_table(g_rates));
+		}
+		catch (const std::runtime_error& e)
+		{
+			logErr(g_rates << ": " << e.what());
+			free(g_rates);
+			free(g_base_currency);
+			return 1;
+		}
+		free(g_rates);
+	}
+	if (g_watch_dir)
+	{
+#ifdef HAVE_SYS_INOTIFY_H
+		ret = run_watch();
+#else
+		logErr("--watch is not supported on this platform");
+		ret = 1;
+#endif
+	}
+	else if (g_output_dir)
+		ret = run_batch();
+	else if (analysis_mode())
+	{
+		ret = run_analysis();
+		free(g_lots);
+		free(g_output);
+		return ret;
+	}
+	if (g_output_dir)
+	{
+		free(g_output_dir);
+		free(g_journal);
+		free(g_watch_dir);
+		free(g_error_dir);
+		free(g_base_currency);
+		return ret;
+	}
+	
 	try
 	{
 		std::string in;
-		auto eit = std::istreambuf_iterator<char>();
-		if (g_input)
+		std::unique_ptr<mapped_tape> tape;
+		if (g_from_tape)
+			tape.reset(new mapped_tape(g_inputs[0].c_str()));
+		else
+			read_input(g_inputs[0] != "-" ? g_inputs[0].c_str() : nullptr, in);
+		size_t in_size = tape ? tape->size_ : in.size();
+		
+		std::shared_ptr<ofx_document> doc;
+		if (g_validate)
 		{
-			std::ifstream fi(g_input);
-			fi.exceptions(std::ifstream::failbit);
-			in.assign(std::istreambuf_iterator<char>(fi), eit);
+			if (!validate_ofx(in))
+				ret = 1;
 		}
 		else
-			in.assign(std::istreambuf_iterator<char>(std::cin), eit);
-		
-		size_t pos = in.find("<OFX>");
-		if (pos == std::string::npos)
-			throw std::runtime_error("Not an OFX file");
-		pos += 5;
-		
-		auto doc = std::make_shared<rapidjson::Document>(rapidjson::kObjectType);
-		if (process_ofx(doc, in, pos))
 		{
-			rapidjson::StringBuffer sbuf;
-			rapidjson::Writer<rapidjson::StringBuffer> writer(sbuf);
-			doc->Accept(writer);
+			extra_sinks extra;
+			std::ofstream fcsv;
+			std::unique_ptr<csv_sink> csv;
+			if (g_csv)
+			{
+				fcsv.exceptions(std::ifstream::failbit);
+				fcsv.open(g_csv);
+				csv.reset(new csv_sink(fcsv));
+				extra.csv_ = csv.get();
+			}
+			stats_sink stats;
+			if (g_stats)
+				extra.stats_ = &stats;
+			std::unique_ptr<tape_sink> tape_out;
+			if (g_tape)
+			{
+				tape_out.reset(new tape_sink(tape ? tape->hdr_->version_ : ofx_header_version(str_view(in.data(), ofx_body_start(in)))));
+				extra.tape_ = tape_out.get();
+			}
 			
+			if (extra.csv_ || extra.stats_ || extra.tape_)
+				doc = tape ? replay_ofx(*tape, extra) : parse_ofx(in, extra);
+			else
+				doc = tape ? replay_ofx(*tape) : parse_ofx(in);
+			if (doc && g_stats)
+			{
+				std::ofstream fstats;
+				fstats.exceptions(std::ifstream::failbit);
+				fstats.open(g_stats);
+				stats.write(fstats);
+			}
+			if (doc && g_tape)
+				tape_out->write(g_tape);
+		}
+		if (doc && !g_canonical && g_jobs != 1 && in_size >= json_pieces::parallel_min_size)
+		{
+			json_pieces pieces(*doc);
+			{
+				worker_pool pool(g_jobs);
+				pieces.serialize(pool);
+			}
+			int fd = STDOUT_FILENO;
+			if (g_output)
+			{
+				fd = open(g_output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+				if (fd < 0)
+					throw std::ifstream::failure("open");
+			}
+			else
+				std::cout.flush();
+			bool ok = pieces.write(fd);
+			if (g_output && close(fd) != 0)
+				ok = false;
+			if (!ok)
+				throw std::ifstream::failure("writev");
+		}
+		else if (doc)
+		{
+			rapidjson::StringBuffer sbuf;
+			write_json(*doc, sbuf);
 			std::ofstream fo;
 			if (g_output)
 			{
@@ -1709,7 +6560,10 @@ int main(int argc, char *argv[])
 		logErr(e.what());
 		ret = 1;
 	}
-	free(g_input);
 	free(g_output);
+	free(g_csv);
+	free(g_stats);
+	free(g_tape);
+	free(g_base_currency);
 	return ret;
 }
@@ -0,0 +1,543 @@
+//
+// ofx2json converts OFX files to JSON
+// Copyright (C) 2019  Thomas Bluemel <thomas@reactsoft.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#ifndef OFX_READER_H
+#define OFX_READER_H
+
+// Pull style tokenizer for OFX documents, both SGML (1.x) and XML (2.x)
+
+#include <string>
+#include <map>
+#include <ostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#if defined(HAVE_STD_STRING_VIEW) || __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace ofx2json
+{
+
+#if defined(HAVE_STD_STRING_VIEW) || __cplusplus >= 201703L
+typedef std::string_view str_view;
+#else
+// Minimal stand-in for std::string_view when building as C++11
+class str_view
+{
+public:
+	static const size_t npos = std::string::npos;
+	
+	str_view():
+		data_(nullptr),
+		size_(0)
+	{
+	}
+	
+	str_view(const char *data, size_t size):
+		data_(data),
+		size_(size)
+	{
+	}
+	
+	str_view(const char *str):
+		data_(str),
+		size_(strlen(str))
+	{
+	}
+	
+	str_view(const std::string& str):
+		data_(str.data()),
+		size_(str.size())
+	{
+	}
+	
+	explicit operator std::string() const
+	{
+		return std::string(data_, size_);
+	}
+	
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t length() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	const char* begin() const { return data_; }
+	const char* end() const { return data_ + size_; }
+	char operator[](size_t i) const { return data_[i]; }
+	
+	str_view substr(size_t pos, size_t len = npos) const
+	{
+		return str_view(data_ + pos, std::min(len, size_ - pos));
+	}
+	
+	size_t find(char ch, size_t pos = 0) const
+	{
+		for (size_t i = pos; i < size_; i++)
+		{
+			if (data_[i] == ch)
+				return i;
+		}
+		return npos;
+	}
+	
+	size_t find(const char* s, size_t pos = 0) const
+	{
+		size_t len = strlen(s);
+		for (size_t i = pos; i + len <= size_; i++)
+		{
+			if (memcmp(data_ + i, s, len) == 0)
+				return i;
+		}
+		return npos;
+	}
+	
+	friend bool operator==(str_view a, str_view b)
+	{
+		return a.size_ == b.size_ && memcmp(a.data_, b.data_, a.size_) == 0;
+	}
+	
+	friend bool operator!=(str_view a, str_view b)
+	{
+		return !(a == b);
+	}
+	
+	friend std::ostream& operator<<(std::ostream& os, str_view v)
+	{
+		return os.write(v.data_, v.size_);
+	}
+	
+private:
+	const char *data_;
+	size_t size_;
+};
+#endif
+
+inline char fold_upper(char ch)
+{
+	return (unsigned char)(ch - 'a') < 26 ? ch - ('a' - 'A') : ch;
+}
+
+// FNV-1a over the upper case folded name, as computed by read_name
+inline uint32_t name_hash_step(uint32_t h, char ch)
+{
+	return (h ^ (unsigned char)fold_upper(ch)) * 16777619u;
+}
+
+inline uint32_t name_hash(str_view name)
+{
+	uint32_t h = 2166136261u;
+	for (char ch : name)
+		h = name_hash_step(h, ch);
+	return h;
+}
+
+// Case insensitive comparison of element names
+inline bool name_equals(str_view a, str_view b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (fold_upper(a[i]) != fold_upper(b[i]))
+			return false;
+	}
+	return true;
+}
+
+// Skips white space at pos, returns whether there was any
+inline bool skip_ws(str_view str, size_t& pos)
+{
+	size_t start = pos;
+	while (pos < str.size() && isspace(str[pos]))
+		pos++;
+	return pos > start;
+}
+
+// Returns one token per call to next().  Names and text are views into the
+// input, or into a buffer of the reader for text with entities, and stay
+// valid until the next call.  In insitu mode, text is decoded in place,
+// which modifies the input.
+class ofx_reader
+{
+public:
+	enum kind
+	{
+		eof = 0,
+		start_tag,
+		end_tag,
+		empty_tag, // <NAME/>
+		text, // text following a start tag, name_ is that of the tag
+		error
+	};
+	
+	struct token
+	{
+		kind kind_;
+		str_view name_;
+		uint32_t hash_; // name_hash(name_)
+		str_view text_;
+		const std::map<std::string, std::string>* attrs_;
+	};
+	
+	ofx_reader(std::string& str, size_t pos = 0, bool insitu = false):
+		str_(str),
+		pos_(pos),
+		insitu_(insitu),
+		pending_text_(false)
+	{
+		tok_ = token{eof, str_view(), 0, str_view(), &attrs_};
+	}
+	
+	size_t pos() const
+	{
+		return pos_;
+	}
+	
+	const token& next()
+	{
+		if (pending_text_)
+		{
+			pending_text_ = false;
+			tok_.kind_ = text;
+			tok_.text_ = decode(text_);
+			return tok_;
+		}
+		
+		tok_.text_ = str_view();
+		skip_ws(str_, pos_);
+		if (pos_ >= str_.size())
+			return set(eof);
+		if (str_[pos_] != '<')
+			return set(error);
+		pos_++;
+		skip_ws(str_, pos_);
+		if (pos_ >= str_.size())
+			return set(error);
+		bool closing = false;
+		if (str_[pos_] == '/')
+		{
+			closing = true;
+			pos_++;
+			skip_ws(str_, pos_);
+			if (pos_ >= str_.size())
+				return set(error);
+		}
+		if (!read_name(str_, pos_, tok_.name_, tok_.hash_))
+			return set(error);
+		if (closing)
+		{
+			skip_ws(str_, pos_);
+			if (pos_ >= str_.size() || str_[pos_] != '>')
+				return set(error);
+			pos_++;
+			return set(end_tag);
+		}
+		
+		attrs_.clear();
+		if (skip_ws(str_, pos_))
+		{
+			do
+			{
+				if (str_[pos_] == '>' || str_[pos_] == '/')
+					break;
+				
+				str_view at_name, at_val;
+				uint32_t at_hash;
+				if (!read_name(str_, pos_, at_name, at_hash))
+					return set(error);
+				skip_ws(str_, pos_);
+				if (pos_ >= str_.size())
+					return set(error);
+				if (str_[pos_] == '=')
+				{
+					pos_++;
+					skip_ws(str_, pos_);
+					if (pos_ >= str_.size())
+						return set(error);
+					bool quoted = (str_[pos_] == '\"');
+					if (quoted)
+						pos_++;
+					if (!read_attrval(str_, pos_, at_val, quoted))
+						return set(error);
+					if (quoted)
+					{
+						if (str_[pos_] != '\"')
+							return set(error);
+						pos_++;
+					}
+				}
+				skip_ws(str_, pos_);
+				attrs_.insert(std::make_pair(std::string(at_name), try_xml_decode(at_val)));
+			} while (pos_ < str_.size());
+		}
+		
+		if (pos_ >= str_.size())
+			return set(error);
+		
+		bool empty = false;
+		if (str_.size() > 1 && str_[pos_] == '/')
+		{
+			empty = true;
+			pos_++;
+		}
+		
+		skip_ws(str_, pos_);
+		if (pos_ >= str_.size() || str_[pos_] != '>')
+			return set(error);
+		pos_++;
+		
+		if (empty)
+			return set(empty_tag);
+		if (!read_text(str_, pos_, text_))
+			return set(error);
+		pending_text_ = !text_.empty();
+		return set(start_tag);
+	}
+	
+	// Consumes the text token following the current start tag, if any
+	str_view take_text()
+	{
+		if (!pending_text_)
+			return str_view();
+		pending_text_ = false;
+		return decode(text_);
+	}
+	
+	// Skips to the end tag of the current start tag without tokenizing the
+	// children, so that the next token is that end tag.  Returns false and
+	// leaves the position unchanged if there is no end tag, as with SGML
+	// elements that only hold text.
+	bool skip_children()
+	{
+		if (tok_.kind_ != start_tag && tok_.kind_ != text)
+			return false;
+		str_view name = tok_.name_;
+		if (!text_.empty())
+		{
+			// an element with text has no children, so its end tag, if
+			// any, follows right away
+			size_t q = pos_ + 1;
+			if (pos_ >= str_.size() || str_[pos_] != '<' || q >= str_.size() || str_[q] != '/')
+				return false;
+			q++;
+			skip_ws(str_, q);
+			if (!tag_name_at(str_, q, name))
+				return false;
+			pending_text_ = false;
+			return true;
+		}
+		size_t depth = 0;
+		for (size_t p = str_.find('<', pos_); p != std::string::npos; p = str_.find('<', p + 1))
+		{
+			size_t q = p + 1;
+			bool closing = (q < str_.size() && str_[q] == '/');
+			if (closing)
+			{
+				q++;
+				skip_ws(str_, q);
+			}
+			if (!tag_name_at(str_, q, name))
+				continue;
+			q += name.size();
+			if (closing)
+			{
+				if (depth-- == 0)
+				{
+					pos_ = p;
+					pending_text_ = false;
+					return true;
+				}
+			}
+			else
+			{
+				size_t gt = str_.find('>', q);
+				if (gt == std::string::npos)
+					return false;
+				if (str_[gt - 1] != '/')
+					depth++;
+			}
+		}
+		return false;
+	}
+	
+private:
+	// Whether the tag name at pos is name
+	static bool tag_name_at(const std::string& str, size_t pos, str_view name)
+	{
+		if (pos + name.size() > str.size() || !name_equals(str_view(&str[pos], name.size()), name))
+			return false;
+		pos += name.size();
+		return pos >= str.size() || isspace(str[pos]) || str[pos] == '>' || str[pos] == '/';
+	}
+	
+	static bool read_text(const std::string& str, size_t& pos, str_view& txt)
+	{
+		skip_ws(str, pos);
+		size_t start = pos;
+		while (pos < str.size())
+		{
+			char ch = str[pos];
+			if (ch == '<' || ch == '>')
+			{
+				size_t end = pos;
+				while (end > start && isspace(str[end - 1]))
+					end--;
+				txt = str_view(str.data() + start, end - start);
+				return true;
+			}
+			pos++;
+		}
+		
+		return false;
+	}
+	
+	static bool read_name(const std::string& str, size_t& pos, str_view& txt, uint32_t& hash)
+	{
+		size_t start = pos;
+		uint32_t h = 2166136261u;
+		while (pos < str.size())
+		{
+			char ch = str[pos];
+			if (isspace(ch) || ch == '<' || ch == '>' || ch == '/' || ch == '=' || ch == '\"')
+				break;
+			h = name_hash_step(h, ch);
+			pos++;
+		}
+		
+		hash = h;
+		txt = str_view(str.data() + start, pos - start);
+		return !txt.empty();
+	}
+	
+	static bool read_attrval(const std::string& str, size_t& pos, str_view& txt, bool quoted)
+	{
+		size_t start = pos;
+		while (pos < str.size())
+		{
+			char ch = str[pos];
+			if (!quoted && (isspace(ch) || ch == '<' || ch == '>' || ch == '/' || ch == '=' || ch == '\"'))
+				break;
+			else if (quoted && ch == '\"')
+				break;
+			pos++;
+		}
+		
+		txt = str_view(str.data() + start, pos - start);
+		if (pos >= str.size() && quoted)
+			return false;
+		return !txt.empty();
+	}
+	
+	// Decodes the entities in txt into out, which may be txt itself
+	static size_t xml_decode(str_view txt, char *out)
+	{
+		size_t olen = 0;
+		size_t pos = 0;
+		while (pos < txt.size())
+		{
+			char ch = txt[pos];
+			if (ch == '&')
+			{
+				size_t len = txt.substr(pos + 1, 5).find(';');
+				if (len != str_view::npos && len > 0)
+				{
+					static const struct
+					{
+						const char *name;
+						char ch;
+					} xml_entities[] = {
+						{ "quot", '\"' },
+						{ "amp", '&' },
+						{ "apos", '\'' },
+						{ "lt", '<' },
+						{ "gt", '>' },
+					};
+					
+					str_view entity = txt.substr(pos + 1, len);
+					bool found = false;
+					for (auto const& e : xml_entities)
+					{
+						if (entity == e.name)
+						{
+							out[olen++] = e.ch;
+							pos += len + 2;
+							found = true;
+							break;
+						}
+					}
+					if (found)
+						continue;
+				}
+			}
+			
+			out[olen++] = ch;
+			pos++;
+		}
+		
+		return olen;
+	}
+	
+	static std::string try_xml_decode(str_view txt)
+	{
+		std::string ret(txt.size(), '\0');
+		ret.resize(xml_decode(txt, &ret[0]));
+		return ret;
+	}
+	
+	// Returns txt itself if it contains no entities, otherwise decodes it into buf
+	static str_view decode_text(str_view txt, std::string& buf)
+	{
+		if (txt.find('&') == str_view::npos)
+			return txt;
+		buf = try_xml_decode(txt);
+		return buf;
+	}
+	
+	// Like decode_text, but decodes in place; txt must point into str
+	static str_view decode_text_insitu(std::string& str, str_view txt)
+	{
+		if (txt.find('&') == str_view::npos)
+			return txt;
+		char *out = &str[txt.data() - str.data()];
+		return str_view(out, xml_decode(txt, out));
+	}
+	
+	const token& set(kind k)
+	{
+		tok_.kind_ = k;
+		return tok_;
+	}
+	
+	str_view decode(str_view txt)
+	{
+		return insitu_ ? decode_text_insitu(str_, txt) : decode_text(txt, text_buf_);
+	}
+	
+	std::string& str_;
+	size_t pos_;
+	bool insitu_;
+	bool pending_text_;
+	str_view text_;
+	std::string text_buf_;
+	std::map<std::string, std::string> attrs_;
+	token tok_;
+};
+
+} // namespace ofx2json
+
+#endif
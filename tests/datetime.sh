@@ -0,0 +1,38 @@
+#!/bin/sh
+# DTPOSTED values with their expected UTC time and offset, as written by
+# --utc-offsets
+
+. "${srcdir:-.}/testlib.sh"
+
+while read dtposted utc tzoff; do
+	ofx="OFXHEADER:100
+DATA:OFXSGML
+VERSION:102
+
+<OFX><BANKMSGSRSV1><STMTTRNRS><TRNUID>1<STMTRS><CURDEF>USD
+<BANKACCTFROM><BANKID>1<ACCTID>1<ACCTTYPE>CHECKING</BANKACCTFROM>
+<BANKTRANLIST><STMTTRN><TRNTYPE>DEBIT<DTPOSTED>$dtposted<TRNAMT>-1<FITID>1</STMTTRN></BANKTRANLIST>
+</STMTRS></STMTTRNRS></BANKMSGSRSV1></OFX>"
+	out=$(echo "$ofx" | "$ofx2json" -q -U -)
+	check "$dtposted" "\"dtposted\":\"$utc\",\"dtpostedtzoff\":\"$tzoff\"" "$(echo "$out" | grep -o '"dtposted":"[^"]*","dtpostedtzoff":"[^"]*"')"
+done <<'TABLE'
+20240105 2024-01-05T00:00:00Z +00:00
+20240105120000 2024-01-05T12:00:00Z +00:00
+20240105120000.123 2024-01-05T12:00:00.123Z +00:00
+20240105120000.000[-5:EST] 2024-01-05T17:00:00Z -05:00
+20240105120000.000[+5.30:IST] 2024-01-05T06:30:00Z +05:30
+20240105120000.000[-3.30] 2024-01-05T15:30:00Z -03:30
+20240105120000.000[+5.45] 2024-01-05T06:15:00Z +05:45
+20240105120000.000[+5.5] 2024-01-05T06:30:00Z +05:30
+20240105120000.000[-0.30] 2024-01-05T12:30:00Z -00:30
+20240105120000.000[+5.75] 2024-01-05T06:15:00Z +05:45
+20240105120000.000[+5.25] 2024-01-05T06:45:00Z +05:15
+20240105120000.000[+5.50] 2024-01-05T06:30:00Z +05:30
+20240105120000.000[+5.15] 2024-01-05T06:45:00Z +05:15
+20240105120000.000[+3.60] 2024-01-05T08:24:00Z +03:36
+20240105120000.000[-9.90] 2024-01-05T21:54:00Z -09:54
+20240105120000.000[+5.00] 2024-01-05T07:00:00Z +05:00
+20240101003000[+1] 2023-12-31T23:30:00Z +01:00
+TABLE
+
+finish
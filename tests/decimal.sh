@@ -0,0 +1,18 @@
+#!/bin/sh
+# Exact decimals through the lot engine (decimal.ofx):
+#   d1-d3  a third of a lot's cost, then half of the rest, which ties and
+#          rounds to even (3.333333334)
+#   p1-p4  UNITS with more than 9 fractional digits, rounded half to even
+#   q1-q2  a 1:3 split, rounding the units of the lot
+#   o1     UNITS * UNITPRICE overflows, the buy is skipped with an error
+#   o2     UNITS beyond the largest accepted decimal, the buy is ignored
+
+. "${srcdir:-.}/testlib.sh"
+
+out=$("$ofx2json" -q -L fifo "$fixtures/decimal.ofx")
+check "exit status" 1 $?
+check "lots" "$(cat "$fixtures/decimal.json")" "$out"
+err=$("$ofx2json" -L fifo "$fixtures/decimal.ofx" 2>&1 >/dev/null)
+check "overflow error" "Error: transaction o1 skipped: decimal overflow" "$err"
+
+finish
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Realized gains and open lots of lots.ofx by each method: two buys, a sale
+# that splits the second lot, a 2:1 split, a sale across both lots, a sale
+# of more units than are open, and a buy that stays open.
+
+. "${srcdir:-.}/testlib.sh"
+
+for method in fifo lifo avg; do
+	check "--lots $method" "$(cat "$fixtures/lots_$method.json")" "$("$ofx2json" -q -L $method "$fixtures/lots.ofx")"
+done
+
+finish
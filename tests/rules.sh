@@ -0,0 +1,20 @@
+#!/bin/sh
+# Categories of the transactions of rules.ofx by rules.tsv.  min= and max=
+# bound TRNAMT inclusively, and the first matching rule wins.
+
+. "${srcdir:-.}/testlib.sh"
+
+expected="1 Refund
+2 Big purchase
+3 Purchase
+4 -
+5 Salary
+6 Other income
+7 -
+8 -"
+
+actual=$("$ofx2json" -q -R "$fixtures/rules.tsv" "$fixtures/rules.ofx" | tr '{' '\n' | grep '"fitid"' |
+	sed -e 's/.*"fitid":"\([^"]*\)".*"category":"\([^"]*\)".*/\1 \2/' -e 's/.*"fitid":"\([^"]*\)".*/\1 -/')
+check "categories" "$expected" "$actual"
+
+finish
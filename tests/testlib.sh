@@ -0,0 +1,24 @@
+# Sourced by the test scripts.  Checks count failures instead of stopping
+# at the first one; finish exits with the result.
+
+ofx2json=${OFX2JSON:-../src/ofx2json}
+fixtures=${srcdir:-.}
+failures=0
+
+# check NAME EXPECTED ACTUAL
+check()
+{
+	if [ "$2" != "$3" ]; then
+		echo "FAIL: $1"
+		echo "  expected: $2"
+		echo "  actual:   $3"
+		failures=$((failures + 1))
+	fi
+}
+
+finish()
+{
+	[ $failures -eq 0 ] && exit 0
+	echo "$failures check(s) failed"
+	exit 1
+}